@@ -20,6 +20,7 @@
 #define _hCraft2__ENTITY__ENTITY__H_
 
 #include "util/position.hpp"
+#include "entity/metadata.hpp"
 #include <unordered_set>
 #include <mutex>
 
@@ -30,7 +31,21 @@ namespace hc {
   class player;
   class world;
   class chunk;
-  class entity_metadata;
+  class packet;
+  class packet_builder;
+  
+  
+  /* 
+   * Bits of the flags byte stored at index 0 of every entity's metadata.
+   */
+  enum entity_flag
+  {
+    EF_ON_FIRE    = 0x01,
+    EF_CROUCHED   = 0x02,
+    EF_SPRINTING  = 0x08,
+    EF_EATING     = 0x10, // also drinking, blocking
+    EF_INVISIBLE  = 0x20,
+  };
   
   
   /* 
@@ -38,12 +53,19 @@ namespace hc {
    */
   class entity
   {
+    friend class entity_tracker;
+    
   protected:
     int eid;
     entity_pos pos;
     vector3 vel;      // velocity
     vector3 vol;      // volume occupied
     int health;       // in half-heart units
+    unsigned char flags;
+    
+    // built when the entity is spawned, and updated in place afterwards.
+    entity_metadata meta;
+    std::mutex meta_mtx;
     
     world *w;
     chunk *curr_ch;   // the chunk the entity is currently in.
@@ -66,17 +88,18 @@ namespace hc {
      */
     virtual void build_metadata (entity_metadata& metadata);
     
-    
-    
     /* 
-     * Makes the entity visible to the specified player.
+     * Turns the specified entity flag on or off.  Players that can see the
+     * entity are sent the change on the next tick.
      */
-    virtual void spawn_to (player *pl) = 0;
+    void set_flag (entity_flag flag, bool on);
+    
+    
     
     /* 
-     * Removes the entity from the sight of the specified player.
+     * Builds the packet that makes the entity visible to players.
      */
-    virtual void despawn_from (player *pl);
+    virtual packet* make_spawn_packet (packet_builder *builder) = 0;
     
     
     
@@ -0,0 +1,132 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft2__ENTITY__GRID__H_
+#define _hCraft2__ENTITY__GRID__H_
+
+#include "util/position.hpp"
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+
+
+namespace hc {
+  
+  // forward decs:
+  class entity;
+
+#define ENTITY_GRID_CELL_SHIFT    4 // 16x16 block cells (the size of a chunk)
+  
+  /* 
+   * Spatial index of the entities in a world.
+   * 
+   * Entities are bucketed into square cells by their X/Z position, so range
+   * queries only look at the entities in the cells that overlap the range,
+   * and only take a single lock.
+   */
+  class entity_grid
+  {
+    std::unordered_map<unsigned long long, std::vector<entity *>> cells;
+    std::mutex mtx;
+  
+  public:
+    /* 
+     * The result of a range query.
+     * Iterating over it does not allocate memory.  The grid stays locked for
+     * as long as the range object is alive, so keep it short-lived and do
+     * not modify the grid while holding one.
+     */
+    class range
+    {
+      friend class entity_grid;
+      
+      entity_grid *grid;
+      std::unique_lock<std::mutex> lock;
+      int cx0, cz0, cx1, cz1; // cells (inclusive)
+      double x0, z0, x1, z1;  // exact bounds (half-open)
+    
+    public:
+      class iterator
+      {
+        const range *r;
+        int cx, cz;
+        const std::vector<entity *> *cell;
+        unsigned int i;
+      
+      public:
+        iterator (const range *r, bool end);
+      
+      private:
+        // skips to the next entity that lies within the range.
+        void settle ();
+      
+      public:
+        inline entity* operator* () const { return (*this->cell)[this->i]; }
+        
+        inline iterator&
+        operator++ ()
+          { ++ this->i; this->settle (); return *this; }
+        
+        inline bool
+        operator!= (const iterator& other) const
+          { return this->cell != other.cell || this->i != other.i; }
+      };
+    
+    private:
+      range (entity_grid *grid, double x0, double z0, double x1, double z1);
+      
+      bool contains (entity *ent) const;
+    
+    public:
+      inline iterator begin () const { return iterator (this, false); }
+      inline iterator end () const { return iterator (this, true); }
+    };
+  
+  private:
+    const std::vector<entity *>* find_cell (int cx, int cz) const;
+    
+    void insert_no_lock (entity *ent, int cx, int cz);
+    void remove_no_lock (entity *ent, int cx, int cz);
+  
+  public:
+    /* 
+     * Inserts the specified entity into the cell that contains `pos'.
+     */
+    void insert (entity *ent, entity_pos pos);
+    
+    /* 
+     * Removes the specified entity from the cell that contains `pos'.
+     */
+    void remove (entity *ent, entity_pos pos);
+    
+    /* 
+     * Moves the specified entity between cells, if its position change from
+     * `from' to `to' crossed a cell boundary.
+     */
+    void move (entity *ent, entity_pos from, entity_pos to);
+    
+    /* 
+     * Returns the entities whose X/Z position is within the rectangle
+     * [x0, x1) x [z0, z1).
+     */
+    range query (double x0, double z0, double x1, double z1);
+  };
+}
+
+#endif
+
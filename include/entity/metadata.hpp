@@ -19,7 +19,8 @@
 #ifndef _hCraft2__ENTITY__METADATA__H_
 #define _hCraft2__ENTITY__METADATA__H_
 
-#include <unordered_map>
+#include "network/packet.hpp"
+#include <string>
 
 
 namespace hc {
@@ -66,20 +67,48 @@ namespace hc {
   };
   
   
+#define ENTITY_METADATA_SLOTS   32 // indices are 5 bits wide
+  
   /*
    * When entities are spawned, their metadata is sent to nearby players using
    * this dictionary format.
+   * 
+   * Values are kept in fixed slots (one per index), and every slot modified
+   * since the last call to clear_changes () is marked as changed, so that
+   * later updates only carry the values that actually changed.  The encoded
+   * form of the whole dictionary is cached until a value changes.
    */
   class entity_metadata
   {
-    std::unordered_map<int, entity_metadata_value> data;
+    entity_metadata_value slots[ENTITY_METADATA_SLOTS];
+    unsigned int used;      // bitmask of slots that hold a value
+    unsigned int changed;   // bitmask of modified slots
+    
+    mutable packet cache;
+    mutable bool cache_valid;
     
   public:
+    inline bool has_changes () const { return this->changed != 0; }
+    inline void clear_changes () { this->changed = 0; }
+    
+  public:
+    entity_metadata ();
     ~entity_metadata ();
     
+  private:
+    // returns the slot at the specified index if it holds a value of the
+    // given type.
+    entity_metadata_value* find (int index, entity_metadata_type type);
+    
+    // frees the slot's previous value and marks it as changed.
+    entity_metadata_value* reset (int index, entity_metadata_type type);
+    
+    void encode_slot (packet *pack, int index) const;
+    
   public:
     /* 
      * `put' methods:
+     * Writing the value a slot already holds does not mark it as changed.
      */
     //--------------------------------------------------------------------------
     
@@ -99,6 +128,12 @@ namespace hc {
      * specified packet.
      */
     void encode (packet *pack) const;
+    
+    /* 
+     * Encodes only the values changed since the last call to clear_changes ()
+     * to the end of the specified packet.
+     */
+    void encode_changes (packet *pack) const;
   };
 }
 
@@ -35,11 +35,14 @@ namespace hc {
   {
     player *pl;
     
+  public:
+    inline player* get_player () { return this->pl; }
+    
   public:
     player_entity (player *pl, int eid);
     
   public:
-    virtual void spawn_to (player *pl) override;
+    virtual packet* make_spawn_packet (packet_builder *builder) override;
     
     virtual void spawn (world *w, entity_pos pos) override;
     
@@ -0,0 +1,129 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft2__ENTITY__TRACKER__H_
+#define _hCraft2__ENTITY__TRACKER__H_
+
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <utility>
+
+
+namespace hc {
+  
+  // forward decs:
+  class entity;
+  class player;
+  class world;
+  class connection;
+  class shared_packet;
+  
+  /* 
+   * Keeps track of which players can see each of the entities in a world.
+   * 
+   * Once every tick, entities are spawned to players that come within view
+   * distance and despawned from ones that leave it, and the players that
+   * already see an entity are only sent the change in its position and
+   * rotation since the last tick (as a relative move whenever possible),
+   * along with any metadata values that changed.
+   * 
+   * Packets are only built while the tracker is locked, and are sent once
+   * it has been unlocked, since sending takes the receiving connection's
+   * lock, and connections call into the tracker with theirs held.
+   */
+  class entity_tracker
+  {
+    struct tracked_entity
+    {
+      entity *ent;
+      std::vector<player *> viewers; // sorted
+      
+      // last sent state:
+      int x, y, z;  // fixed-point (1/32 block)
+      unsigned char yaw, pitch;
+      int ticks;    // since the last teleport
+    };
+    
+    typedef std::vector<std::pair<connection *, shared_packet *>> packet_list;
+  
+  private:
+    world& w;
+    std::unordered_map<int, tracked_entity> ents; // by entity ID
+    std::mutex mtx;
+    
+    std::vector<entity *> added; // tracked starting from the next tick
+    std::mutex add_mtx;
+    
+    // held while packets built by the tracker are being sent, so that
+    // a player cannot be destroyed while it is still being sent to.
+    std::mutex send_mtx;
+    
+    std::vector<player *> nearby; // reused by tick()
+    packet_list outbox;           // reused by tick()
+  
+  public:
+    entity_tracker (world& w);
+  
+  private:
+    /* 
+     * Stores the players that should be able to see the specified entity
+     * in `out' (sorted).
+     */
+    void find_viewers (entity *ent, std::vector<player *>& out);
+    
+    /* 
+     * Starts tracking the entities passed to add() since the last tick.
+     */
+    void track_added ();
+    
+    /* 
+     * Sends the specified tracked entity's viewers the changes in its
+     * position and rotation since the last tick.
+     */
+    void send_movement (tracked_entity& te, packet_list& out);
+    
+    /* 
+     * Sends the specified tracked entity's viewers the metadata values that
+     * changed since the last tick.
+     */
+    void send_metadata (tracked_entity& te, packet_list& out);
+  
+  public:
+    /* 
+     * Starts tracking the specified entity.  Nearby players will see it
+     * spawned on the next tick.
+     */
+    void add (entity *ent);
+    
+    /* 
+     * Stops tracking the specified entity, and despawns it from all players
+     * that could see it.
+     */
+    void remove (entity *ent);
+    
+    /* 
+     * Updates entity visibility and sends movement updates.
+     * Called once per tick.
+     */
+    void tick ();
+  };
+}
+
+#endif
+
@@ -74,19 +74,53 @@ namespace hc {
     
     virtual packet* make_unload_chunk (int cx, int cz);
     
+    virtual packet* make_map_chunk_bulk (chunk *const *chs, int count);
+    
+    virtual packet* make_multi_block_change (int cx, int cz,
+      const unsigned short *changes, int count, chunk *ch);
+    
+    virtual packet* make_block_change (int x, int y, int z, unsigned short id,
+      unsigned char meta);
+    
     virtual packet* make_disconnect (const std::string& msg) override;
     
     virtual packet* make_set_compression (int threshold);
     
-    virtual packet* make_player_list_add (uuid_t uuid, const std::string& name,
-      game_mode gm, int ping) override;
+    virtual packet* make_player_list_add (const player_list_entry *entries,
+      int count) override;
+    
+    virtual packet* make_player_list_update_gm (
+      const player_list_entry *entries, int count) override;
     
-    virtual packet* make_player_list_remove (uuid_t uuid,
-      const std::string& name) override;
+    virtual packet* make_player_list_update_ping (
+      const player_list_entry *entries, int count) override;
+    
+    virtual packet* make_player_list_remove (const player_list_entry *entries,
+      int count) override;
     
     virtual packet* make_spawn_player (int eid, uuid_t uuid, double x,
       double y, double z, float yaw, float pitch, short curr_item,
       const entity_metadata& meta) override;
+    
+    virtual packet* make_destroy_entities (const int *eids, int count) override;
+    
+    virtual packet* make_entity_relative_move (int eid, int dx, int dy, int dz,
+      bool on_ground) override;
+    
+    virtual packet* make_entity_look (int eid, unsigned char yaw,
+      unsigned char pitch, bool on_ground) override;
+    
+    virtual packet* make_entity_look_and_relative_move (int eid, int dx,
+      int dy, int dz, unsigned char yaw, unsigned char pitch,
+      bool on_ground) override;
+    
+    virtual packet* make_entity_teleport (int eid, int x, int y, int z,
+      unsigned char yaw, unsigned char pitch, bool on_ground) override;
+    
+    virtual packet* make_entity_head_look (int eid, unsigned char yaw) override;
+    
+    virtual packet* make_entity_metadata (int eid,
+      const entity_metadata& meta) override;
   };
 }
 
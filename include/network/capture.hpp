@@ -0,0 +1,125 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft2__NETWORK__CAPTURE__H_
+#define _hCraft2__NETWORK__CAPTURE__H_
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+
+
+namespace hc {
+  
+  /* 
+   * Capture files hold the decoded packets a single connection received,
+   * in the order they were read.
+   * 
+   * Header:
+   *   "HCAP", version (byte), flags (byte), session start time (long, unix
+   *   time in milliseconds), IP address (byte length + characters)
+   * 
+   * Followed by one record per packet:
+   *   microseconds since the previous record (VarLong), and the packet
+   *   itself, as delimited (VarInt length + body)
+   */
+
+#define CAPTURE_VERSION         1
+#define CAPTURE_F_ENCRYPTED     0x1 // the server asked for encryption
+  
+  
+  
+  /* 
+   * Records a connection's incoming packets to a capture file.
+   */
+  class capture_writer
+  {
+    std::ofstream fs;
+    std::string path;
+    std::chrono::steady_clock::time_point last;
+  
+  public:
+    inline bool is_open () const { return this->fs.is_open (); }
+  
+  public:
+    ~capture_writer ();
+  
+  public:
+    /* 
+     * Creates a capture file for a new session at the specified path.
+     * Returns false if the file could not be created.
+     */
+    bool open (const std::string& path, const char *ip, unsigned char flags);
+    
+    /* 
+     * Appends the specified delimited packet to the capture file, stamped
+     * with the current time.
+     */
+    void record (const unsigned char *data, unsigned int len);
+    
+    /* 
+     * Closes the capture file.  The file is deleted unless `keep' is true
+     * (e.g. for sessions that never logged in).
+     */
+    void close (bool keep = true);
+  };
+  
+  
+  
+  /* 
+   * Reads back the packets stored in a capture file.
+   */
+  class capture_reader
+  {
+  public:
+    struct record
+    {
+      long long time; // microseconds since the start of the session
+      std::vector<unsigned char> data;
+    };
+  
+  private:
+    std::ifstream fs;
+    unsigned char flags;
+    long long start;
+    std::string ip;
+    long long time;
+  
+  public:
+    inline unsigned char get_flags () const { return this->flags; }
+    inline long long get_start_time () const { return this->start; }
+    inline const std::string& get_ip () const { return this->ip; }
+  
+  public:
+    /* 
+     * Opens the specified capture file and reads its header.
+     * Returns false if the file could not be opened, or is not a capture
+     * file.
+     */
+    bool open (const std::string& path);
+    
+    /* 
+     * Reads the next record into `rec'.
+     * Returns false at the end of the file (or if the rest of it is cut off).
+     */
+    bool next (record& rec);
+  };
+}
+
+#endif
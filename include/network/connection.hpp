@@ -19,32 +19,55 @@
 #ifndef _hCraft2__NETWORK__CONNECTION__H_
 #define _hCraft2__NETWORK__CONNECTION__H_
 
-#include "util/thread_pool.hpp"
+#include "util/refc.hpp"
+#include "util/timer_wheel.hpp"
+#include "system/server.hpp"
+#include "network/packet_pool.hpp"
+#include "network/packet.hpp"
+#include "network/capture.hpp"
 #include <event2/util.h>
 #include <mutex>
 #include <functional>
 #include <deque>
+#include <atomic>
+#include <chrono>
 
 
 // forward decs:
 struct bufferevent;
 struct event_base;
 struct evbuffer;
+struct evbuffer_cb_info;
 struct event;
 
 namespace hc {
   
   // forward decs:
-  class server;
   class logger;
   class protocol;
-  class packet;
+  class shared_packet;
   class player;
   
-#define READ_BUFFER_SIZE    512
-
 // terminates the connection after the packet has been sent:
 #define CONN_SEND_DISCONNECT  0x1
+
+// the packet may be discarded if the connection is over its send budget
+// (e.g. entity movement updates that will be superseded anyway):
+#define CONN_SEND_DROPPABLE   0x2
+
+// packets sent before this one are written out before it, and packets sent
+// after it are written out after it, regardless of their priority lanes
+// (e.g. when the protocol's framing changes).  implied by CONN_SEND_DISCONNECT.
+#define CONN_SEND_BARRIER     0x4
+
+// places the packet in the specified priority lane instead of the one chosen
+// by its builder:
+#define CONN_SEND_PRIORITY(P) ((((P) + 1) & 0x7) << 8)
+
+// per-connection deadlines, the connection is dropped if one expires:
+#define CONN_DEADLINE_LOGIN       0
+#define CONN_DEADLINE_KEEP_ALIVE  1
+#define CONN_DEADLINE_COUNT       2
   
   /* 
    * Wraps around a socket, and handles all the IO related things.
@@ -55,8 +78,11 @@ namespace hc {
     struct packet_container
     {
       int id;
-      packet *pack;
+      struct evbuffer *buf; // packet data, transformed up to `stage'
+      int len;
       unsigned int flags;
+      int stage;            // first out transformer not yet applied
+      unsigned int tmask;   // out transformers active when the packet was queued
     };
     
   private:
@@ -68,23 +94,48 @@ namespace hc {
     bool disconnected;
     bool disconnect_req;
     std::recursive_mutex dc_mtx;
+    bool detached; // no socket, see start_detached()
     
     struct bufferevent *bev;
     struct event_base *evb;
-    unsigned char rbuf[READ_BUFFER_SIZE];
-    int rbuf_len;
-    thread_pool::seq_class *pseq;
-    struct event *tev;
+    server::worker *w; // the worker handling the connection
+    packet_pool rpool; // incoming packet buffers
+    ref_counter refc;  // number of packet handler jobs in progress
+    
+    // decoded packets waiting to be handled, in order of arrival.  at most
+    // one drain job is queued (or running) at any time.
+    std::mutex inbox_mtx;
+    packet_block *inbox_head, *inbox_tail;
+    std::atomic<bool> inbox_open; // also read by the drain job without the lock
+    bool draining;
+    struct event *nev; // used by other threads to wake the connection up
+    timer_wheel::timer deadlines[CONN_DEADLINE_COUNT];
     
     // used to transform data:
     std::vector<struct evbuffer *> tbs;
     struct evbuffer *ftb; // final transformed data
+    struct evbuffer *otb; // outgoing data between transformations
     
-    std::deque<packet_container *> outq;
+    // packets waiting to be flushed, one queue per priority:
+    std::deque<packet_container *> lanes[PP_COUNT];
+    std::deque<int> barriers; // IDs of queued barrier packets
+    unsigned int last_tmask;
+    int drr_lane;
+    int drr_deficit[PP_COUNT];
     bool can_send;
-    packet_container *init_pack; // used to initiate writes
+    bool flush_pending;
+    bool drain_dc; // disconnect once the output buffer is drained
+    bool corked;
     int next_packet_id;
     
+    // send budget:
+    std::atomic<long long> qbytes; // queued and unwritten bytes
+    bool over_budget;
+    std::chrono::steady_clock::time_point over_since;
+    
+    std::atomic<long long> sunk_bytes; // sent while detached
+    capture_writer cap;
+    
     protocol *proto;
     player *pl;
     
@@ -98,6 +149,21 @@ namespace hc {
     inline void set_player (player *pl) { this->pl = pl; }
     
     inline std::recursive_mutex& get_dc_mutex () { return this->dc_mtx; }
+    inline ref_counter& get_refc () { return this->refc; }
+    inline long long get_queued_bytes () const { return this->qbytes; }
+    inline long long get_sunk_bytes () const { return this->sunk_bytes; }
+    
+    /* 
+     * Returns true if the connection's send queue has reached its memory
+     * budget.  Producers of bulk data (e.g. chunk streaming) should hold off
+     * sending more until this returns false.
+     */
+    inline bool
+    is_congested () const
+    {
+      int budget = this->srv.get_config ().send_budget;
+      return budget > 0 && this->qbytes >= budget;
+    }
     
   public:
     connection (server& srv, evutil_socket_t sock, const char *ip);
@@ -107,10 +173,23 @@ namespace hc {
     /* 
      * Does all the work of disconnecting the connection.
      * disconnect() merely makes disconnect_() get called by the connection's
-     * timer event to prevent locking the bufferevent.
+     * notification event to prevent locking the bufferevent.
      */
     void disconnect_ ();
     
+    /* 
+     * Wakes up the event loop that the connection is handled by, and makes
+     * it process pending writes and disconnection requests.
+     * Can be called from any thread.
+     */
+    void notify ();
+    
+    /* 
+     * Called from the worker's timer wheel when the specified deadline
+     * expires.
+     */
+    void on_deadline (int which);
+    
     /* 
      * Processes as much read data as possible using the protocol's
      * transformers.
@@ -118,10 +197,77 @@ namespace hc {
     void apply_in_transformations ();
     
     /* 
-     * Applies the protocol's out transformers to the contents of the specified
-     * packet.
+     * Appends the specified chain of decoded packets to the connection's
+     * inbox, and queues a drain job if there is none in flight.
+     */
+    void post_packets (packet_block *head, packet_block *tail);
+    
+    /* 
+     * Handles packets from the inbox until it is empty.
+     * Runs in the server's thread pool.
+     */
+    void drain_inbox ();
+    
+    /* 
+     * Returns all packets still held in the inbox to the pool.
+     */
+    void clear_inbox ();
+    
+    /* 
+     * Applies the protocol's out transformers in the range [from, to) to the
+     * packet data held in the specified buffer, replacing its contents with
+     * the transformed data.
+     * Returns false on failure.
+     */
+    bool apply_out_transformations (struct evbuffer *buf, int from = 0,
+      int to = -1, unsigned int mask = ~0u);
+    
+    /* 
+     * Returns the index of the first active stateful out transformer (or the
+     * number of transformers if there is none), and stores a signature that
+     * identifies the active stateless transformers before it in `sig'.
+     */
+    int stateless_prefix (unsigned long long *sig);
+    
+    /* 
+     * Applies the server's send budget policy to a packet that is about to
+     * be sent with the specified flags.
+     * Returns false if the packet should be discarded.
+     */
+    bool check_budget (unsigned int flags);
+    
+    /* 
+     * Queues the packet data in the specified buffer, that has been
+     * transformed by the out transformers before `stage', in the
+     * appropriate priority lane.
+     */
+    void enqueue (struct evbuffer *buf, packet_priority prio,
+      unsigned int flags, int stage);
+    
+    /* 
+     * Removes and returns the next packet to be written out, according to
+     * the server's scheduling mode, or null if there is none.
+     */
+    packet_container* next_container ();
+    
+    /* 
+     * Moves queued packets into the bufferevent's output buffer, until the
+     * server's send window is filled.
+     * Must be called from the connection's event loop.
+     */
+    void flush ();
+    
+    /* 
+     * Turns TCP_CORK on or off for the connection's socket, if enabled in
+     * the server's configuration.
+     */
+    void set_cork (bool on);
+    
+    /* 
+     * Starts recording the packets received by the connection to a new
+     * file in the server's capture directory.
      */
-    void apply_out_transformations (packet *pack);
+    void start_capture ();
     
   public:
     /* 
@@ -131,8 +277,36 @@ namespace hc {
     
     /* 
      * Starts handling reading and writing.
+     * The connection is placed on the least loaded worker; the specified
+     * worker (usually the one that accepted the connection) is preferred
+     * if its load is close enough.
      */
-    void start_io ();
+    void start_io (server::worker *pref = nullptr);
+    
+    /* 
+     * Sets the connection up without a socket or a worker, to have packets
+     * fed to its handler directly (e.g. when replaying a capture).  Packets
+     * sent through the connection are fully transformed, counted, and then
+     * discarded.
+     */
+    void start_detached ();
+    
+    /* 
+     * Called by the connection's worker once every tick (20ms).
+     */
+    void tick ();
+    
+    /* 
+     * Disconnects the connection if the specified deadline is not cleared
+     * within the given amount of milliseconds.  Setting a deadline that is
+     * already pending pushes it back.
+     */
+    void set_deadline (int which, int ms);
+    
+    /* 
+     * Cancels the specified deadline.
+     */
+    void clear_deadline (int which);
     
   public:
     /* 
@@ -153,6 +327,13 @@ namespace hc {
      * NOTE: Ownership of the packet is passed to the connection.
      */
     void send (packet *pack, unsigned int flags = 0);
+    
+    /* 
+     * Queues the specified shared packet to be sent.
+     * The connection holds a reference to the packet until it is written;
+     * the caller's reference is left untouched.
+     */
+    void send (shared_packet *sp, unsigned int flags = 0);
   
   private:
     /* 
@@ -166,7 +347,10 @@ namespace hc {
     
     static void on_event (struct bufferevent *bev, short events, void *ctx);
     
-    static void on_time (evutil_socket_t fd, short events, void *ctx);
+    static void on_notify (evutil_socket_t fd, short events, void *ctx);
+    
+    static void on_output_drained (struct evbuffer *buf,
+      const struct evbuffer_cb_info *info, void *ctx);
     
     //--------------------------------------------------------------------------
   };
@@ -39,11 +39,17 @@ namespace hc {
     
     /* 
      * Switches the protocol implementation used by the underlying connection.
+     * If `status' is true, a lightweight implementation that can only answer
+     * server list pings is used instead.
      */
-    void success (const char *proto, packet_reader& reader);
+    void success (const char *proto, packet_reader& reader, bool status);
   
   public:
     virtual void handle (packet_reader& reader) override;
+    
+    // inspecting the handshake is cheap.
+    virtual bool is_inline_safe (packet_reader& reader) override
+      { return true; }
   };
 }
 
@@ -92,6 +92,7 @@ namespace hc {
     virtual void handle_p07 (packet_reader& reader); // player digging
     virtual void handle_p08 (packet_reader& reader); // player block placement
     virtual void handle_p09 (packet_reader& reader); // held item change
+    virtual void handle_p0b (packet_reader& reader); // entity action
     virtual void handle_p0d (packet_reader& reader); // close window
     virtual void handle_p0e (packet_reader& reader); // click window
     virtual void handle_p10 (packet_reader& reader); // creative inventory action
@@ -103,6 +104,12 @@ namespace hc {
      */
     virtual void handle (packet_reader& reader) override;
     
+    /* 
+     * Returns true for play state packets that are cheap enough to be
+     * handled on the connection's I/O thread.
+     */
+    virtual bool is_inline_safe (packet_reader& reader) override;
+    
     virtual void set_connection (connection *conn) override;
     
     virtual void disconnect () override;
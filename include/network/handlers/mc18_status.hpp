@@ -0,0 +1,61 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft2__NETWORK__HANDLERS__MC18_STATUS__H_
+#define _hCraft2__NETWORK__HANDLERS__MC18_STATUS__H_
+
+#include "network/packet_handler.hpp"
+
+
+namespace hc {
+  
+  // forward decs:
+  class server;
+  class packet;
+  class mc18_packet_builder;
+  
+  /* 
+   * A lightweight packet handler for 1.8 clients that connect only to query
+   * the server's status (server list pings).  It never creates a player, and
+   * every packet it handles is answered straight from the connection's I/O
+   * thread.
+   */
+  class mc18_status_handler: public packet_handler
+  {
+  private:
+    bool handshaken;
+    
+  public:
+    mc18_status_handler ();
+    
+  public:
+    /* 
+     * Builds the status response sent to server list pings.
+     */
+    static packet* make_response (server& srv, mc18_packet_builder *builder);
+    
+  public:
+    virtual void handle (packet_reader& reader) override;
+    
+    virtual bool is_inline_safe (packet_reader& reader) override
+      { return true; }
+  };
+}
+
+#endif
+
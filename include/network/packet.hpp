@@ -41,9 +41,17 @@ namespace hc {
     inline void rewind () { this->pos = 0; }
     
   public:
+    packet_reader ();
     packet_reader (const unsigned char *arr, unsigned int len, bool copy = false);
     ~packet_reader ();
     
+  public:
+    /* 
+     * Makes the reader wrap around the specified byte array instead (without
+     * copying it), and rewinds it.
+     */
+    void reset (const unsigned char *arr, unsigned int len);
+    
   public:
     /* 
      * `read' methods:
@@ -67,6 +75,22 @@ namespace hc {
   
   
   
+  /* 
+   * Outgoing packets are queued in one of several lanes, according to their
+   * priority.  Order is preserved only between packets in the same lane.
+   */
+  enum packet_priority
+  {
+    PP_CONTROL,   // keep-alives, login, protocol state changes
+    PP_MOVEMENT,  // entity/player movement and other game state (default)
+    PP_CHAT,
+    PP_BULK,      // terrain
+    
+    PP_COUNT,
+  };
+  
+  
+  
   /* 
    * Wraps around a byte array and provides convenient methods to write binary
    * data to it.
@@ -78,6 +102,7 @@ namespace hc {
     unsigned int len;
     unsigned int cap;
     unsigned int rbeg; // number of bytes reserved at the beginning
+    packet_priority prio;
     
   public:
     inline const unsigned char* get_data () const { return this->arr; }
@@ -88,6 +113,9 @@ namespace hc {
     inline void rewind () { this->pos = 0; }
     inline void reset () { this->pos = this->len = 0; }
     
+    inline packet_priority get_priority () const { return this->prio; }
+    inline void set_priority (packet_priority prio) { this->prio = prio; }
+    
   public:
     packet (unsigned int init_cap = 16, unsigned int reserve_beg = 5);
     ~packet ();
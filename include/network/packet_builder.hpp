@@ -36,6 +36,19 @@ namespace hc {
   class packet;
   class entity_metadata;
   
+  
+  /* 
+   * A single player's entry in the tab player list.
+   */
+  struct player_list_entry
+  {
+    uuid_t uuid;
+    std::string name;
+    game_mode gm;
+    int ping; // in milliseconds
+  };
+  
+  
   /* 
    * Base class for packet builders.
    */
@@ -54,15 +67,47 @@ namespace hc {
     
     virtual packet* make_chat_message (const std::string& msg) = 0;
     
-    virtual packet* make_player_list_add (uuid_t uuid, const std::string& name,
-      game_mode gm, int ping) = 0;
+    // player list packets carry any number of entries at once.
+    
+    virtual packet* make_player_list_add (const player_list_entry *entries,
+      int count) = 0;
+    
+    virtual packet* make_player_list_update_gm (
+      const player_list_entry *entries, int count) = 0;
+    
+    virtual packet* make_player_list_update_ping (
+      const player_list_entry *entries, int count) = 0;
     
-    virtual packet* make_player_list_remove (uuid_t uuid,
-      const std::string& name) = 0;
+    virtual packet* make_player_list_remove (const player_list_entry *entries,
+      int count) = 0;
     
     virtual packet* make_spawn_player (int eid, uuid_t uuid, double x,
       double y, double z, float yaw, float pitch, short curr_item,
       const entity_metadata& meta) = 0;
+    
+    virtual packet* make_destroy_entities (const int *eids, int count) = 0;
+    
+    // positions are in fixed-point (1/32 block) units, and angles in 1/256
+    // of a full turn.
+    
+    virtual packet* make_entity_relative_move (int eid, int dx, int dy, int dz,
+      bool on_ground) = 0;
+    
+    virtual packet* make_entity_look (int eid, unsigned char yaw,
+      unsigned char pitch, bool on_ground) = 0;
+    
+    virtual packet* make_entity_look_and_relative_move (int eid, int dx,
+      int dy, int dz, unsigned char yaw, unsigned char pitch,
+      bool on_ground) = 0;
+    
+    virtual packet* make_entity_teleport (int eid, int x, int y, int z,
+      unsigned char yaw, unsigned char pitch, bool on_ground) = 0;
+    
+    virtual packet* make_entity_head_look (int eid, unsigned char yaw) = 0;
+    
+    // carries only the values changed since meta.clear_changes () was called.
+    virtual packet* make_entity_metadata (int eid,
+      const entity_metadata& meta) = 0;
   };
 }
 
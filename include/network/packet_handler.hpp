@@ -51,6 +51,14 @@ namespace hc {
      */
     virtual void handle (packet_reader& reader) = 0;
     
+    /* 
+     * Returns true if the specified packet is cheap to handle and only
+     * touches the connection's own state, in which case the connection may
+     * handle it directly on its I/O thread instead of handing it off to the
+     * thread pool.  The reader is left rewound.
+     */
+    virtual bool is_inline_safe (packet_reader& reader) { return false; }
+    
     /* 
      * Used internally by connections.
      */
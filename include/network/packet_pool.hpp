@@ -0,0 +1,79 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft2__NETWORK__PACKET_POOL__H_
+#define _hCraft2__NETWORK__PACKET_POOL__H_
+
+#include "network/packet.hpp"
+#include <mutex>
+
+
+namespace hc {
+  
+  /* 
+   * A buffer that holds the contents of a single incoming packet, along with
+   * a reader that is set up to read from it.
+   */
+  struct packet_block
+  {
+    packet_reader reader;
+    unsigned char *data;
+    unsigned int cap;
+    int cls;
+    packet_block *next;
+  };
+  
+  
+  
+  /* 
+   * Recycles the buffers incoming packets are read into.
+   * Blocks are kept in free lists of power-of-two size classes, so once a
+   * connection has warmed up, reading packets no longer allocates memory.
+   * 
+   * Blocks may be acquired and released from different threads.
+   */
+  class packet_pool
+  {
+  public:
+    enum { MIN_BLOCK_SIZE = 64, CLASS_COUNT = 16, MAX_FREE_BLOCKS = 32 };
+    
+  private:
+    std::mutex mtx;
+    packet_block *free_lists[CLASS_COUNT];
+    int free_counts[CLASS_COUNT];
+    
+  public:
+    packet_pool ();
+    ~packet_pool ();
+    
+  public:
+    /* 
+     * Returns a block that can hold at least the specified amount of bytes,
+     * or null if the size exceeds the largest size class.
+     */
+    packet_block* acquire (unsigned int size);
+    
+    /* 
+     * Returns the specified block back to the pool.
+     */
+    void release (packet_block *block);
+  };
+}
+
+#endif
+
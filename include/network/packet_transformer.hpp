@@ -19,6 +19,8 @@
 #ifndef _hCraft2__NETWORK__PACKET_TRANSFORMER__H_
 #define _hCraft2__NETWORK__PACKET_TRANSFORMER__H_
 
+struct evbuffer;
+
 
 namespace hc {
   
@@ -41,38 +43,35 @@ namespace hc {
     
   public:
     /* 
-     * Applies the transformation to incoming data.
+     * Applies the transformation to as much of the incoming data in the `in'
+     * buffer as possible, draining the consumed data and appending the
+     * result to `out'.  Incomplete data is left in `in' until more of it
+     * arrives.
      * Returns false on failure.
-     * 
-     * NOTE: The input may represent only a part of a whole packet.
      */
-    virtual bool transform_in (const unsigned char *data, unsigned int len,
-      unsigned char **out, int *out_len, int *consumed) = 0;
+    virtual bool transform_in (struct evbuffer *in, struct evbuffer *out) = 0;
     
     /* 
-     * Applies the transformation to outgoing data.
+     * Applies the transformation to a single outgoing packet, consuming all
+     * of the data in the `in' buffer and writing the result directly into
+     * `out' (which should be empty).
      * Returns false on failure.
      */
-    virtual bool transform_out (const unsigned char *data, unsigned int len,
-      unsigned char **out, int *out_len) = 0;
-    
-    /*
-     * Calculates an upper bound on the size of the output data that would be
-     * returned by transform_in() with the specified input data size.
-     */
-    virtual int estimate_in (unsigned int len) = 0;
+    virtual bool transform_out (struct evbuffer *in, struct evbuffer *out) = 0;
     
-    /*
-     * Calculates an upper bound on the size of the output data that would be
-     * returned by transform_out() with the specified input data size.
+    /* 
+     * Returns true if the output of transform_out() depends on previously
+     * transformed packets (e.g. a stream cipher), and false if it depends
+     * only on the packet itself and on the transformer's settings.
      */
-    virtual int estimate_out (unsigned int len) = 0;
+    virtual bool is_stateful () const { return true; }
     
     /* 
-     * Returns 1 if the given input is enough data for transform_in(); 0 if
-     * more data must be read; and -1 on invalid data.
+     * For stateless transformers: returns a value that identifies the
+     * transformer's settings, so that two transformers with the same
+     * signature produce identical output for the same packet.
      */
-    virtual int in_enough (const unsigned char *data, unsigned int len) = 0;
+    virtual unsigned int signature () const { return 0; }
     
   public:
     /* 
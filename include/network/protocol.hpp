@@ -78,6 +78,13 @@ namespace hc {
      * The returned object should be deleted once no longer needed.
      */
     static protocol* create (const char *version);
+    
+    /* 
+     * Creates a lightweight implementation of the specified client version
+     * that can only answer server list pings.
+     * Returns null if no matching protocol implementation is found.
+     */
+    static protocol* create_status (const char *version);
   };
 }
 
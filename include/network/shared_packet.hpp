@@ -0,0 +1,136 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft2__NETWORK__SHARED_PACKET__H_
+#define _hCraft2__NETWORK__SHARED_PACKET__H_
+
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <string>
+#include <functional>
+
+
+namespace hc {
+  
+  // forward decs:
+  class packet;
+  class packet_builder;
+  class connection;
+  
+  /* 
+   * A reference-counted, immutable packet that can be sent to any number of
+   * connections.
+   * 
+   * Since stateless transformations (e.g. compression) produce the same
+   * output for every connection that uses the same settings, the results of
+   * these are cached in the packet, keyed by the signature of the
+   * transformers that were applied.  Connections then only have to apply
+   * their own stateful transformations (e.g. encryption).
+   */
+  class shared_packet
+  {
+  public:
+    struct frame
+    {
+      unsigned long long sig;
+      unsigned char *data;
+      int len;
+    };
+    
+  private:
+    packet *pack;
+    std::atomic<int> refc;
+    
+    std::deque<frame> frames; // stable element addresses
+    std::mutex frame_mtx;
+    
+  public:
+    inline const packet* get_packet () const { return this->pack; }
+    
+  private:
+    shared_packet (packet *pack);
+    ~shared_packet ();
+    
+  public:
+    /* 
+     * Wraps the specified packet in a new shared packet whose reference
+     * count is one.
+     * NOTE: Ownership of the packet is passed to the shared packet.
+     */
+    static shared_packet* create (packet *pack);
+    
+    /* 
+     * Increments the packet's reference count.
+     */
+    inline shared_packet* grab () { ++ this->refc; return this; }
+    
+    /* 
+     * Decrements the packet's reference count, and destroys it once it
+     * drops to zero.
+     */
+    void release ();
+    
+  public:
+    /* 
+     * Returns the contents of the packet as transformed by the stateless
+     * transformers described by the specified signature.  If no such frame
+     * has been produced yet, the given function is called to produce it
+     * (it should allocate the returned data with new[]).
+     * Returns null if the frame could not be produced.
+     * 
+     * The returned frame remains valid for as long as the packet is alive.
+     */
+    const frame* get_frame (unsigned long long sig,
+      std::function<bool (unsigned char **data, int *len)>&& produce);
+  };
+  
+  
+  
+  /* 
+   * A packet that is built at most once per protocol (on first use), and
+   * shared between all the connections that speak that protocol.
+   */
+  class protocol_packet
+  {
+    std::function<packet* (packet_builder *)> build;
+    std::vector<std::pair<std::string, shared_packet *>> packs;
+    
+  public:
+    protocol_packet (std::function<packet* (packet_builder *)>&& build);
+    ~protocol_packet ();
+    
+  public:
+    /* 
+     * Returns the packet as built for the specified connection's protocol.
+     * The returned packet is owned by this object; grab it to keep it
+     * around for longer.
+     */
+    shared_packet* get (connection& conn);
+    
+    /* 
+     * Sends the packet, as built for the connection's protocol, to the
+     * specified connection.
+     */
+    void send_to (connection& conn);
+  };
+}
+
+#endif
+
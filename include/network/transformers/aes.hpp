@@ -40,17 +40,9 @@ namespace hc {
     ~aes_transformer ();
     
   public:
-    virtual bool transform_in (const unsigned char *data, unsigned int len,
-      unsigned char **out, int *out_len, int *consumed) override;
+    virtual bool transform_in (struct evbuffer *in, struct evbuffer *out) override;
     
-    virtual bool transform_out (const unsigned char *data, unsigned int len,
-      unsigned char **out, int *out_len) override;
-    
-    virtual int estimate_in (unsigned int len) override;
-    
-    virtual int estimate_out (unsigned int len) override;
-    
-    virtual int in_enough (const unsigned char *data, unsigned int len) override;
+    virtual bool transform_out (struct evbuffer *in, struct evbuffer *out) override;
       
   public:
     /* 
@@ -58,6 +50,12 @@ namespace hc {
      * Must be called before start ().
      */
     void setup (const unsigned char *ssec);
+    
+    /* 
+     * Returns true if the processor supports AES-NI instructions, which
+     * Crypto++ uses automatically when available.
+     */
+    static bool hardware_accelerated ();
   };
 }
 
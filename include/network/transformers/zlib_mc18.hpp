@@ -39,17 +39,15 @@ namespace hc {
     ~zlib_mc18_transformer ();
     
   public:
-    virtual bool transform_in (const unsigned char *data, unsigned int len,
-      unsigned char **out, int *out_len, int *consumed) override;
+    virtual bool transform_in (struct evbuffer *in, struct evbuffer *out) override;
     
-    virtual bool transform_out (const unsigned char *data, unsigned int len,
-      unsigned char **out, int *out_len) override;
+    virtual bool transform_out (struct evbuffer *in, struct evbuffer *out) override;
     
-    virtual int estimate_in (unsigned int len) override;
+    // every packet is compressed on its own (the stream is reset).
+    virtual bool is_stateful () const override { return false; }
     
-    virtual int estimate_out (unsigned int len) override;
-    
-    virtual int in_enough (const unsigned char *data, unsigned int len) override;
+    virtual unsigned int signature () const override
+      { return ((unsigned int)this->threshold << 4) | (this->level & 0xF); }
     
   public:
     /* 
@@ -29,8 +29,10 @@
 #include <random>
 #include <mutex>
 #include <unordered_set>
+#include <vector>
 #include <sstream>
 #include <atomic>
+#include <chrono>
 
 #include <iostream> // DEBUG
 
@@ -46,6 +48,20 @@ namespace hc {
   class player_entity;
   
   
+//------------------------------------------------------------------------------
+  
+  /* 
+   * Parts of a player's tab list entry that have changed since they were
+   * last broadcast.
+   */
+  enum player_list_change
+  {
+    PLC_GAMEMODE  = 0x1,
+    PLC_PING      = 0x2,
+  };
+  
+  
+  
 //------------------------------------------------------------------------------
   
   // forward decs:
@@ -106,10 +122,16 @@ namespace hc {
     // keep-alive related:
     bool ka_expecting;  // whether we're expecting a response keep-alive packet.
     int ka_id;          // the keep alive ID we're expecting.
+    std::chrono::steady_clock::time_point ka_sent;
+    std::atomic<int> ping; // in milliseconds
+    
+    std::atomic<int> list_changes; // player_list_change bits
     
     world *w; // current world
     std::recursive_mutex w_mtx;
     std::unordered_set<chunk_pos> vis_chunks;
+    std::mutex vis_mtx;
+    std::atomic<bool> stream_deferred; // chunks held back due to congestion
     entity_pos pos;
     bool spawned;
     entity_pos spawn_pos;
@@ -134,6 +156,17 @@ namespace hc {
     inline world* get_world () { return this->w; }
     inline entity_pos& position () { return this->pos; }
     inline player_entity* get_entity () { return this->pent; }
+    inline int get_ping () const { return this->ping; }
+    
+    // returns and clears the player's pending player_list_change bits.
+    inline int take_list_changes () { return this->list_changes.exchange (0); }
+    
+    inline bool
+    can_see_chunk (chunk_pos cp)
+    {
+      std::lock_guard<std::mutex> guard { this->vis_mtx };
+      return this->vis_chunks.find (cp) != this->vis_chunks.end ();
+    }
     
     inline inventory& get_inv () { return this->inv; }
     inline window* get_window () { return this->openw; }
@@ -149,6 +182,24 @@ namespace hc {
      */
     void stream_chunks ();
     
+    /* 
+     * Checks whether the chunk at the specified coordinates should be sent
+     * to the player, and if so, marks it as visible.
+     */
+    bool claim_chunk (int x, int z);
+    
+    /* 
+     * Sends the specified chunks to the player packed in as few Map Chunk
+     * Bulk packets as the configured size limit allows.
+     */
+    void send_chunk_bulk (const std::vector<chunk *>& chs);
+    
+    /* 
+     * Spawns the player once the chunk it is supposed to spawn on has been
+     * sent.
+     */
+    void on_chunk_sent (int x, int z);
+    
     void handle_command (const std::string& msg);
     
   public:
@@ -190,6 +241,11 @@ namespace hc {
      */
     void on_place (int x, int y, int z, block_face face);
     
+    /* 
+     * Invoked when the player starts or stops sneaking, sprinting, etc.
+     */
+    void on_action (entity_action action);
+    
 //------------------------------------------------------------------------------
     
   public:
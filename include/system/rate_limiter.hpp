@@ -0,0 +1,89 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft2__SYSTEM__RATE_LIMITER__H_
+#define _hCraft2__SYSTEM__RATE_LIMITER__H_
+
+#include <unordered_map>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+
+namespace hc {
+  
+#define RATE_LIMITER_SHARDS   16
+  
+  /* 
+   * Token buckets keyed by IP address.
+   * Every address is allowed to consume tokens at a steady rate, plus a
+   * limited burst.  Buckets are spread across several independently locked
+   * shards, so that worker threads rarely contend for the same lock.
+   */
+  class rate_limiter
+  {
+    struct bucket
+    {
+      double tokens;
+      std::chrono::steady_clock::time_point last;
+    };
+    
+    struct shard
+    {
+      std::mutex mtx;
+      std::unordered_map<std::string, bucket> buckets;
+    };
+    
+  private:
+    double rate;  // tokens per second, zero for no limit
+    double burst; // bucket capacity
+    shard shards[RATE_LIMITER_SHARDS];
+    std::atomic<long long> dropped;
+    
+  public:
+    inline bool is_enabled () const { return this->rate > 0.0; }
+    inline long long get_dropped () const { return this->dropped; }
+    
+  public:
+    rate_limiter ();
+    
+  public:
+    /* 
+     * Sets the rate (in tokens per second) and the burst size of every
+     * bucket.  A rate of zero disables the limiter.
+     */
+    void configure (double rate, double burst);
+    
+    /* 
+     * Attempts to take the specified amount of tokens from the bucket of the
+     * given address.  Returns false (and counts the tokens as dropped) if
+     * there are not enough tokens left.
+     */
+    bool consume (const char *ip, int count = 1);
+    
+    /* 
+     * Removes buckets that have been refilled completely, and so hold no
+     * information worth keeping.
+     */
+    void cleanup ();
+  };
+}
+
+#endif
+
@@ -21,12 +21,16 @@
 
 #include "util/scheduler.hpp"
 #include "util/thread_pool.hpp"
+#include "util/timer_wheel.hpp"
+#include "system/rate_limiter.hpp"
 #include "world/lighting.hpp"
 #include <vector>
 #include <stdexcept>
 #include <string>
 #include <mutex>
 #include <functional>
+#include <atomic>
+#include <chrono>
 #include <event2/util.h>
 #include <cryptopp/rsa.h>
 #include <unordered_map>
@@ -49,6 +53,31 @@ namespace hc {
   class uuid_manager;
   class command;
   class authenticator;
+  class packet;
+  class shared_packet;
+  class packet_builder;
+  
+  
+  /* 
+   * What is done with connections whose send queues exceed their memory
+   * budget.
+   */
+  enum send_budget_policy
+  {
+    SBP_DEFER,      // nothing; cooperating producers back off
+    SBP_DROP,       // discard packets that were sent as droppable
+    SBP_DISCONNECT, // disconnect if over budget for too long
+  };
+  
+  /* 
+   * How a connection picks the next packet from its priority lanes.
+   */
+  enum send_schedule_mode
+  {
+    SSM_STRICT,   // always drain the highest priority lane first
+    SSM_WEIGHTED, // deficit round-robin, using per-lane weights
+  };
+  
   
   
   /* 
@@ -92,11 +121,47 @@ namespace hc {
     };
     
   public:
+    /* 
+     * Event loop statistics gathered by a worker thread.
+     * All latencies are in microseconds.
+     */
+    struct worker_stats
+    {
+      std::atomic<long long> iterations;
+      std::atomic<long long> lat_last;
+      std::atomic<long long> lat_avg;
+      std::atomic<long long> lat_max;
+      
+      // load:
+      std::atomic<int> conns;         // number of active connections
+      std::atomic<long long> bytes;   // total bytes read and written
+      std::atomic<long long> bps;     // bytes read and written per second
+      long long last_bytes;
+      int rate_probes;
+    };
+    
     struct worker
     {
+      server *srv;
+      int index;
       hc::thread *th;
       struct event_base *evbase;
-      int evs;  // number of events
+      struct evconnlistener *listener; // null if not accepting connections
+      
+      // a timer event that is used to measure how late the worker's event
+      // loop gets around to running callbacks.  also makes sure that the
+      // event base is never empty.
+      struct event *probe;
+      std::chrono::steady_clock::time_point probe_due;
+      worker_stats stats;
+      
+      // drives all of the worker's connections, and the deadlines in its
+      // timer wheel.
+      struct event *tick;
+      timer_wheel *timers;
+      std::mutex conns_mtx;
+      std::vector<connection *> conns;
+      std::vector<connection *> tick_conns; // reused by on_tick()
     };
     
     /* 
@@ -109,17 +174,39 @@ namespace hc {
       bool online;
       
       int port;
+      int workers;      // zero to use one worker per core
+      bool reuse_port;  // one SO_REUSEPORT listener per worker
       bool encryption;
       int compress_threshold;
       int compress_level;
+      bool tcp_nodelay;
+      bool tcp_cork;    // cork the socket while the send queue is drained
+      int flush_window; // in milliseconds, zero to flush immediately
+      int max_packet_size; // largest incoming packet accepted, in bytes
+      int send_budget;  // max bytes queued per connection, zero for no limit
+      send_budget_policy send_policy;
+      int send_grace;   // in milliseconds, for SBP_DISCONNECT
+      send_schedule_mode send_mode;
+      int send_weights[4]; // one per packet priority (control, movement, chat, bulk)
+      int send_window;  // max bytes moved into a socket's output buffer at once
+      int login_timeout; // in milliseconds
+      double connect_rate; // new connections per second per IP, zero for no limit
+      int connect_burst;
+      double packet_rate;  // packets per second per IP, zero for no limit
+      int packet_burst;
+      bool capture;     // record incoming packets to capture files
+      std::string capture_dir;
       
       std::string mainw;
       int view_dist;
+      int chunk_bulk;   // max bytes per Map Chunk Bulk packet, zero to send chunks one by one
+      int chat_radius;  // in blocks, zero for server-wide chat
     };
   
   private:
     logger& log;
     bool running, started;
+    bool offline; // started with start_offline()
     std::vector<init_fin_pair> inits;
     
     configuration cfg;
@@ -129,10 +216,9 @@ namespace hc {
     bool workers_created;
     struct event *pipe_event;
     
-    struct evconnlistener *listener;
-    
     std::vector<connection *> conns;
     std::vector<connection *> gray_conns;
+    std::atomic<long long> queued_bytes; // in all outbound queues
     std::vector<player *> players;
     std::recursive_mutex conn_mtx;
     
@@ -155,6 +241,19 @@ namespace hc {
     // encryption/authentication:
     CryptoPP::RSA::PrivateKey rsa_p;
     
+    // cached server list status response:
+    shared_packet *status_pack;
+    std::string status_proto; // protocol the packet was built for
+    std::string status_motd;
+    int status_players;
+    std::mutex status_mtx;
+    
+    // per-IP rate limiting:
+    rate_limiter conn_limiter;
+    rate_limiter packet_limiter;
+    
+    std::atomic<int> capture_id;
+    
   public:
     inline bool is_running () const { return this->running; }
     
@@ -168,6 +267,10 @@ namespace hc {
     inline uuid_manager& get_uuid_manager () { return *this->uman; }
     inline authenticator& get_auth () { return *this->auth; }
     inline int get_player_count () const { return (int)this->players.size (); }
+    inline long long get_queued_bytes () const { return this->queued_bytes; }
+    inline void account_queued (long long delta) { this->queued_bytes += delta; }
+    inline rate_limiter& get_packet_limiter () { return this->packet_limiter; }
+    inline int next_capture_id () { return ++ this->capture_id; }
     
     inline CryptoPP::RSA::PublicKey get_pub_key ()
       { return CryptoPP::RSA::PublicKey (this->rsa_p); }
@@ -184,6 +287,18 @@ namespace hc {
   private:
     void worker_func (void *ctx);
     
+    /* 
+     * Called periodically by every worker's event loop to measure its
+     * latency.
+     */
+    static void on_probe (evutil_socket_t sock, short what, void *arg);
+    
+    /* 
+     * Called by every worker's event loop once per tick to advance its
+     * timer wheel and tick the connections it handles.
+     */
+    static void on_tick (evutil_socket_t sock, short what, void *arg);
+    
     
     /* 
      * Called when the listener accepts a new connection.
@@ -204,6 +319,14 @@ namespace hc {
      */
     void start ();
     
+    /* 
+     * Starts the server up without listening for connections, for tools
+     * that drive connections by hand (e.g. the capture replayer).
+     * Worlds are not saved, and authentication, encryption, rate limiting
+     * and capturing are all turned off regardless of the configuration.
+     */
+    void start_offline ();
+    
     /* 
      * Stops the server.
      */
@@ -212,10 +335,12 @@ namespace hc {
     
     
     /* 
-     * Returns the server worker that is currently handling the least amount
-     * of events, and increases its event count.
+     * Returns the server worker that currently has the least amount of load,
+     * based on its number of active connections and its throughput.
+     * If a preferred worker is specified, it is returned as long as its load
+     * is not much higher than that of the least loaded worker.
      */
-    worker* min_worker ();
+    worker* min_worker (worker *pref = nullptr);
     
   public:
     /* 
@@ -230,6 +355,15 @@ namespace hc {
      */
     void clean_gray ();
     
+    /* 
+     * Returns the response to server list pings for the specified protocol.
+     * The packet is cached, and only rebuilt (using the given function) when
+     * the player count or the MOTD changes.
+     * The returned packet is grabbed on the caller's behalf.
+     */
+    shared_packet* get_status_packet (const std::string& proto,
+      std::function<packet* ()>&& build);
+    
     
     
     /*
@@ -250,6 +384,19 @@ namespace hc {
      */
     void all_players (std::function<void (player *)>&& cb);
     
+    /* 
+     * Sends a packet to every player in the server.  The packet is built
+     * (and compressed) at most once per protocol, and shared between all
+     * connections.
+     */
+    void broadcast (std::function<packet* (packet_builder *)>&& build);
+    
+    /* 
+     * Sends the specified chat message to every player in the server
+     * (old-style formatting is used).
+     */
+    void broadcast_message (const std::string& msg);
+    
     
     
     /* 
@@ -277,12 +424,28 @@ namespace hc {
     void cleanup_conns (scheduler::task& task);
     
     /* 
-     * Sends Keep-Alive packets to all connected players; and checks whether
-     * there exist any connections that did not respond with a keep alive
-     * packet within 20 seconds.
+     * Sends Keep-Alive packets to all connected players.  Players that do not
+     * respond in time are disconnected by their connection's keep-alive
+     * deadline.
      */
     void keep_alive (scheduler::task& task);
     
+    /* 
+     * Logs the event loop statistics of all worker threads.
+     */
+    void report_workers (scheduler::task& task);
+    
+    /* 
+     * Forgets about addresses that have not been rate limited recently.
+     */
+    void cleanup_rate_limits (scheduler::task& task);
+    
+    /* 
+     * Runs once per game tick (50ms) to broadcast block changes and entity
+     * movement in all worlds.
+     */
+    void tick_worlds (scheduler::task& task);
+    
     //--------------------------------------------------------------------------
     
   private:
@@ -304,6 +467,7 @@ namespace hc {
      */
     void init_config ();
     void fin_config ();
+    void load_config ();
     
     /* 
      * Sets up encryption-related stuff.
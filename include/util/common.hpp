@@ -45,6 +45,18 @@ namespace hc {
   };
   
   
+  enum entity_action
+  {
+    EA_START_SNEAKING   = 0,
+    EA_STOP_SNEAKING    = 1,
+    EA_LEAVE_BED        = 2,
+    EA_START_SPRINTING  = 3,
+    EA_STOP_SPRINTING   = 4,
+    EA_HORSE_JUMP       = 5,
+    EA_OPEN_INVENTORY   = 6,
+  };
+  
+  
   enum block_face
   {
     BFACE_Y_NEG = 0,
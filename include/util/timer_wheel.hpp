@@ -0,0 +1,124 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft2__UTIL__TIMER_WHEEL__H_
+#define _hCraft2__UTIL__TIMER_WHEEL__H_
+
+#include <functional>
+#include <chrono>
+#include <mutex>
+
+
+namespace hc {
+  
+#define TIMER_WHEEL_LEVELS    4
+#define TIMER_WHEEL_BITS      6
+#define TIMER_WHEEL_SLOTS     (1 << TIMER_WHEEL_BITS)
+  
+  /* 
+   * A hierarchical timing wheel.
+   * Scheduling and cancelling a timer take constant time, and advancing the
+   * wheel only touches the timers that are due (plus an occasional cascade
+   * from a higher level), no matter how many timers are pending.
+   * 
+   * Timers are intrusive: their storage is owned by the caller, and must
+   * outlive the time they spend in the wheel.
+   */
+  class timer_wheel
+  {
+  public:
+    class timer
+    {
+    private:
+      friend class timer_wheel;
+      
+      std::function<void ()> cb;
+      unsigned long long expires; // in ticks
+      timer *prev, *next;
+      bool pending;
+      
+    public:
+      inline bool is_pending () const { return this->pending; }
+      
+    public:
+      timer ()
+        : expires (0), prev (nullptr), next (nullptr), pending (false)
+        { }
+      
+      timer (std::function<void ()>&& cb)
+        : cb (std::move (cb)), expires (0), prev (nullptr), next (nullptr),
+          pending (false)
+        { }
+      
+    public:
+      inline void
+      set_callback (std::function<void ()>&& cb)
+        { this->cb = std::move (cb); }
+    };
+    
+  private:
+    int res; // milliseconds per tick
+    std::chrono::steady_clock::time_point origin;
+    unsigned long long now; // next tick to process
+    timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    int count;
+    std::mutex mtx;
+    
+  public:
+    inline int get_resolution () const { return this->res; }
+    
+  public:
+    /* 
+     * Constructs a new timer wheel that advances in steps of the specified
+     * number of milliseconds.
+     */
+    timer_wheel (int res);
+    
+  private:
+    void insert (timer *t);
+    void unlink (timer *t);
+    
+    /* 
+     * Moves the timers held in the specified slot of a higher level down
+     * to the levels below it.
+     */
+    void cascade (int level, int slot);
+    
+  public:
+    /* 
+     * Arms the specified timer to fire after the given amount of
+     * milliseconds.  If the timer is already pending, it is rescheduled.
+     */
+    void schedule (timer *t, int ms);
+    
+    /* 
+     * Disarms the specified timer, if pending.
+     */
+    void cancel (timer *t);
+    
+    /* 
+     * Processes all ticks up to the current time, invoking the callbacks of
+     * any timers that expire.  Callbacks are called without the wheel being
+     * locked, and so they may freely schedule or cancel timers.
+     */
+    void advance ();
+  };
+}
+
+#endif
+
@@ -23,12 +23,17 @@
 #include "util/position.hpp"
 #include <mutex>
 #include <vector>
+#include <atomic>
+#include <string>
+#include <functional>
 
 
 namespace hc {
   
   // forward decs:
   class entity;
+  class packet;
+  class shared_packet;
   
   
   /* 
@@ -63,11 +68,26 @@ namespace hc {
     std::vector<entity *> ents;
     std::mutex ent_mtx;
     
+    // incremented whenever the chunk's contents are modified.
+    std::atomic<unsigned int> ver;
+    
+    // cached chunk data packet:
+    shared_packet *cache_pack;
+    std::string cache_proto;  // name of the protocol the packet was built for
+    unsigned int cache_ver;   // the chunk's version when it was built
+    std::mutex cache_mtx;
+    
+    // positions of blocks modified since the journal was last taken, packed
+    // as (y << 8) | (z << 4) | x.
+    std::vector<unsigned short> changes;
+    std::mutex change_mtx;
+    
   public:
     inline chunk_pos get_pos () { return this->pos; }
     inline sub_chunk* get_sub (int sy) { return this->subs[sy]; }
     inline unsigned char* get_biomes () { return this->biomes; }
     inline int* get_heightmap () { return this->hmap; }
+    inline unsigned int get_version () const { return this->ver; }
     
     inline int
     get_height (int x, int z)
@@ -103,6 +123,31 @@ namespace hc {
     
     void set_id_and_meta (int x, int y, int z, unsigned short id, unsigned char meta);
     
+  public:
+    /* 
+     * Returns a packet that contains the chunk's data for the specified
+     * protocol.  The packet is cached and shared between all players that
+     * see the chunk, and is only rebuilt (using the given function) once
+     * the chunk has been modified.
+     * The returned packet is grabbed on the caller's behalf.
+     */
+    shared_packet* get_data_packet (const std::string& proto,
+      std::function<packet* ()>&& build);
+    
+  public:
+    /* 
+     * Records that the block at the specified position has been modified.
+     * Returns true if this is the first change since the journal was last
+     * taken, i.e. the chunk has to be queued for broadcasting.
+     */
+    bool journal_change (int x, int y, int z);
+    
+    /* 
+     * Moves the positions recorded in the chunk's change journal into
+     * `out' (sorted, with no duplicates), and clears the journal.
+     */
+    void take_changes (std::vector<unsigned short>& out);
+    
   public:
     /* 
      * Entity management:
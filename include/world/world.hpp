@@ -21,6 +21,8 @@
 
 #include "util/position.hpp"
 #include "world/async_generator.hpp"
+#include "entity/tracker.hpp"
+#include "entity/grid.hpp"
 #include <unordered_map>
 #include <mutex>
 #include <vector>
@@ -36,6 +38,8 @@ namespace hc {
   class player;
   class server;
   class logger;
+  class packet;
+  class packet_builder;
   
   
   /* 
@@ -69,19 +73,32 @@ namespace hc {
     async_generator async_gen;
     world_provider *prov;
     chunk *edge_ch;   // out of bounds chunk
+    bool persistent;  // whether chunks are saved to disk
     
     std::vector<player *> pls;
     std::mutex pl_mtx;
     
+    // chunks with block changes that have yet to be broadcast.
+    std::vector<chunk *> changed_chs;
+    std::mutex change_mtx;
+    
+    entity_grid ent_grid;
+    entity_tracker tracker;
+    
   public:
     inline server& get_server () { return this->srv; }
     inline entity_pos get_spawn_pos () const { return this->inf.spawn_pos; }
     inline async_generator& get_async_gen () { return this->async_gen; }
+    inline entity_grid& get_entity_grid () { return this->ent_grid; }
+    inline entity_tracker& get_tracker () { return this->tracker; }
     inline world_generator* get_generator () { return this->gen; }
     
     inline world_data& get_info () { return this->inf; }
     inline const std::string& get_name () { return this->inf.name; }
     
+    inline bool is_persistent () const { return this->persistent; }
+    inline void set_persistent (bool p) { this->persistent = p; }
+    
   private:
     chunk* get_chunk_no_lock (int x, int z);
     
@@ -89,6 +106,10 @@ namespace hc {
     
     void prepare_oob_chunk ();
     
+    void journal_change (chunk *ch, int x, int y, int z);
+    
+    void broadcast_list_changes ();
+    
   private:
     // used by world::load_from ()
     world (const world_data& wd, server& srv, world_generator *gen,
@@ -148,6 +169,21 @@ namespace hc {
     void set_id_and_meta (int x, int y, int z, unsigned short id,
       unsigned char meta);
     
+    /* 
+     * Sends the blocks modified since the last call to every player that can
+     * see them.  Changes are batched per chunk, so that a large edit costs
+     * a few packets per chunk rather than one per block.
+     * Called once per tick.
+     */
+    void broadcast_changes ();
+    
+    /* 
+     * Broadcasts block changes, entity movement and player list updates made
+     * since the last tick.
+     * Called once per tick.
+     */
+    void tick ();
+    
   //----------------------------------------------------------------------------
     
     
@@ -172,12 +208,32 @@ namespace hc {
      */
     void all_players (std::function<void (player *)>&& cb);
     
+    /* 
+     * Sends a packet to every player in the world.  The packet is built
+     * (and compressed) at most once per protocol, and shared between all
+     * connections.
+     */
+    void broadcast (std::function<packet* (packet_builder *)>&& build);
+    
+    /* 
+     * Adds the specified player to the tab list of everyone in the world,
+     * and sends it the whole list in a single packet.
+     */
+    void list_player (player *pl);
+    
+    /* 
+     * Removes the specified player from the tab list of everyone in the
+     * world.
+     */
+    void unlist_player (player *pl);
+    
   //----------------------------------------------------------------------------
     
     
     
     /* 
      * Saves the world to disk.
+     * Does nothing if the world is not persistent.
      */
     void save_all ();
   };
@@ -22,7 +22,7 @@
 #include "world/chunk.hpp"
 #include "system/server.hpp"
 #include "system/logger.hpp"
-#include "entity/metadata.hpp"
+#include "entity/tracker.hpp"
 
 
 namespace hc {
@@ -30,6 +30,9 @@ namespace hc {
   entity::entity (int eid)
   {
     this->eid = eid;
+    this->flags = 0;
+    this->w = nullptr;
+    this->curr_ch = nullptr;
   }
   
   
@@ -40,19 +43,24 @@ namespace hc {
   void
   entity::build_metadata (entity_metadata& metadata)
   {
-    metadata.put_byte (0, 0); // flags
+    metadata.put_byte (0, this->flags);
     metadata.put_short (1, 0); // air
   }
   
-  
-  
   /* 
-   * Removes the entity from the sight of the specified player.
+   * Turns the specified entity flag on or off.  Players that can see the
+   * entity are sent the change on the next tick.
    */
   void
-  entity::despawn_from (player *pl)
+  entity::set_flag (entity_flag flag, bool on)
   {
+    std::lock_guard<std::mutex> guard (this->meta_mtx);
     
+    if (on)
+      this->flags |= flag;
+    else
+      this->flags &= ~flag;
+    this->meta.put_byte (0, this->flags);
   }
   
   
@@ -65,25 +73,36 @@ namespace hc {
   void
   entity::spawn (world *w, entity_pos pos)
   {
-    std::lock_guard<std::mutex> guard (this->ch_mtx);
+    {
+      std::lock_guard<std::mutex> guard (this->ch_mtx);
+      
+      server& srv = w->get_server ();
+      logger& log = srv.get_logger ();
+      
+      chunk_pos cpos = pos;
+      chunk *ch = w->get_chunk (cpos.x, cpos.z);
+      if (!ch)
+        {
+          log (LT_ERROR) << "Attempted to spawn entity in unloaded chunk." << std::endl;
+          return;
+        }
+      
+      this->w = w;
+      this->pos = pos;
+      this->curr_ch = ch;
+      ch->register_entity (this);
+    }
     
-    server& srv = w->get_server ();
-    logger& log = srv.get_logger ();
-    
-    chunk_pos cpos = pos;
-    chunk *ch = w->get_chunk (cpos.x, cpos.z);
-    if (!ch)
-      {
-        log (LT_ERROR) << "Attempted to spawn entity in unloaded chunk." << std::endl;
-        return;
-      }
-    
-    this->w = w;
-    this->pos = pos;
-    this->curr_ch = ch;
-    ch->register_entity (this);
+    {
+      std::lock_guard<std::mutex> guard (this->meta_mtx);
+      this->build_metadata (this->meta);
+      this->meta.clear_changes ();
+    }
     
+    w->get_entity_grid ().insert (this, pos);
     
+    // nearby players will see the entity on the next tick.
+    w->get_tracker ().add (this);
   }
   
   /* 
@@ -92,10 +111,15 @@ namespace hc {
   void
   entity::despawn ()
   {
-    if (!this->curr_ch)
+    if (!this->w)
       return;
     
-    this->curr_ch->deregister_entity (this);
+    this->w->get_tracker ().remove (this);
+    this->w->get_entity_grid ().remove (this, this->pos);
+    
+    std::lock_guard<std::mutex> guard (this->ch_mtx);
+    if (this->curr_ch)
+      this->curr_ch->deregister_entity (this);
     
     this->w = nullptr;
     this->curr_ch = nullptr;
@@ -115,12 +139,23 @@ namespace hc {
     chunk_pos pcp = this->pos;
     chunk_pos ncp = pos;
     
+    this->w->get_entity_grid ().move (this, this->pos, pos);
     this->pos = pos;
     
     if (pcp != ncp)
       {
+        // move the entity over to its new chunk's entity list, so that it
+        // can be found by whoever looks at the chunk.
         std::lock_guard<std::mutex> guard (this->ch_mtx);
-        this->curr_ch = this->w->get_chunk (ncp.x, ncp.z);
+        chunk *ch = this->w->get_chunk (ncp.x, ncp.z);
+        if (ch != this->curr_ch)
+          {
+            if (this->curr_ch)
+              this->curr_ch->deregister_entity (this);
+            if (ch)
+              ch->register_entity (this);
+            this->curr_ch = ch;
+          }
       }
   }
 }
@@ -0,0 +1,197 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "entity/grid.hpp"
+#include "entity/entity.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+namespace hc {
+  
+  namespace {
+    
+    inline int
+    _to_cell (double v)
+    {
+      return (int)std::floor (v) >> ENTITY_GRID_CELL_SHIFT;
+    }
+    
+    inline unsigned long long
+    _cell_key (int cx, int cz)
+    {
+      return (unsigned int)cx | ((unsigned long long)(unsigned int)cz << 32);
+    }
+  }
+  
+  
+  
+  entity_grid::range::iterator::iterator (const range *r, bool end)
+  {
+    this->r = r;
+    this->i = 0;
+    if (end || r->cx0 > r->cx1 || r->cz0 > r->cz1)
+      {
+        this->cell = nullptr;
+        return;
+      }
+    
+    this->cx = r->cx0;
+    this->cz = r->cz0;
+    this->cell = r->grid->find_cell (this->cx, this->cz);
+    this->settle ();
+  }
+  
+  /* 
+   * Skips to the next entity that lies within the range.
+   */
+  void
+  entity_grid::range::iterator::settle ()
+  {
+    for (;;)
+      {
+        if (this->cell)
+          for (; this->i < this->cell->size (); ++ this->i)
+            if (this->r->contains ((*this->cell)[this->i]))
+              return;
+        
+        // next cell
+        if (++ this->cx > this->r->cx1)
+          {
+            this->cx = this->r->cx0;
+            if (++ this->cz > this->r->cz1)
+              {
+                this->cell = nullptr;
+                this->i = 0;
+                return;
+              }
+          }
+        
+        this->cell = this->r->grid->find_cell (this->cx, this->cz);
+        this->i = 0;
+      }
+  }
+  
+  
+  
+  entity_grid::range::range (entity_grid *grid, double x0, double z0,
+    double x1, double z1)
+    : grid (grid), lock (grid->mtx)
+  {
+    this->x0 = x0;
+    this->z0 = z0;
+    this->x1 = x1;
+    this->z1 = z1;
+    
+    this->cx0 = _to_cell (x0);
+    this->cz0 = _to_cell (z0);
+    this->cx1 = _to_cell (std::nextafter (x1, x0));
+    this->cz1 = _to_cell (std::nextafter (z1, z0));
+  }
+  
+  bool
+  entity_grid::range::contains (entity *ent) const
+  {
+    entity_pos pos = ent->get_pos ();
+    return pos.x >= this->x0 && pos.x < this->x1
+      && pos.z >= this->z0 && pos.z < this->z1;
+  }
+
+
+
+//------------------------------------------------------------------------------
+  
+  const std::vector<entity *>*
+  entity_grid::find_cell (int cx, int cz) const
+  {
+    auto itr = this->cells.find (_cell_key (cx, cz));
+    return (itr == this->cells.end ()) ? nullptr : &itr->second;
+  }
+  
+  
+  
+  void
+  entity_grid::insert_no_lock (entity *ent, int cx, int cz)
+  {
+    this->cells[_cell_key (cx, cz)].push_back (ent);
+  }
+  
+  void
+  entity_grid::remove_no_lock (entity *ent, int cx, int cz)
+  {
+    auto itr = this->cells.find (_cell_key (cx, cz));
+    if (itr == this->cells.end ())
+      return;
+    
+    auto& cell = itr->second;
+    cell.erase (std::remove (cell.begin (), cell.end (), ent), cell.end ());
+    if (cell.empty ())
+      this->cells.erase (itr);
+  }
+  
+  
+  
+  /* 
+   * Inserts the specified entity into the cell that contains `pos'.
+   */
+  void
+  entity_grid::insert (entity *ent, entity_pos pos)
+  {
+    std::lock_guard<std::mutex> guard { this->mtx };
+    this->insert_no_lock (ent, _to_cell (pos.x), _to_cell (pos.z));
+  }
+  
+  /* 
+   * Removes the specified entity from the cell that contains `pos'.
+   */
+  void
+  entity_grid::remove (entity *ent, entity_pos pos)
+  {
+    std::lock_guard<std::mutex> guard { this->mtx };
+    this->remove_no_lock (ent, _to_cell (pos.x), _to_cell (pos.z));
+  }
+  
+  /* 
+   * Moves the specified entity between cells, if its position change from
+   * `from' to `to' crossed a cell boundary.
+   */
+  void
+  entity_grid::move (entity *ent, entity_pos from, entity_pos to)
+  {
+    int fcx = _to_cell (from.x), fcz = _to_cell (from.z);
+    int tcx = _to_cell (to.x), tcz = _to_cell (to.z);
+    if (fcx == tcx && fcz == tcz)
+      return;
+    
+    std::lock_guard<std::mutex> guard { this->mtx };
+    this->remove_no_lock (ent, fcx, fcz);
+    this->insert_no_lock (ent, tcx, tcz);
+  }
+  
+  
+  
+  /* 
+   * Returns the entities whose X/Z position is within the rectangle
+   * [x0, x1) x [z0, z1).
+   */
+  entity_grid::range
+  entity_grid::query (double x0, double z0, double x1, double z1)
+  {
+    return range (this, x0, z0, x1, z1);
+  }
+}
@@ -23,24 +23,60 @@
 
 namespace hc {
   
+  entity_metadata::entity_metadata ()
+    : cache (32, 0)
+  {
+    this->used = 0;
+    this->changed = 0;
+    this->cache_valid = false;
+  }
+  
   entity_metadata::~entity_metadata ()
   {
-    for (auto p : this->data)
+    for (int i = 0; i < ENTITY_METADATA_SLOTS; ++i)
+      if (this->used & (1U << i))
+        this->reset (i, EMT_BYTE);
+  }
+  
+  
+  
+  entity_metadata_value*
+  entity_metadata::find (int index, entity_metadata_type type)
+  {
+    if (index < 0 || index >= ENTITY_METADATA_SLOTS
+      || !(this->used & (1U << index)) || this->slots[index].type != type)
+      return nullptr;
+    return &this->slots[index];
+  }
+  
+  entity_metadata_value*
+  entity_metadata::reset (int index, entity_metadata_type type)
+  {
+    if (index < 0 || index >= ENTITY_METADATA_SLOTS)
+      return nullptr;
+    
+    auto& v = this->slots[index];
+    if (this->used & (1U << index))
       {
-        auto& val = p.second;
-        switch (val.type)
+        switch (v.type)
           {
           case EMT_STRING:
-            delete val.val.str;
+            delete v.val.str;
             break;
           
           case EMT_SLOT:
-            delete val.val.slot;
+            delete v.val.slot;
             break;
           
           default: ;
           }
       }
+    
+    v.type = type;
+    this->used |= 1U << index;
+    this->changed |= 1U << index;
+    this->cache_valid = false;
+    return &v;
   }
   
   
@@ -48,73 +84,157 @@ namespace hc {
   void
   entity_metadata::put_byte (int index, unsigned char val)
   {
-    auto& v = this->data[index];
-    v.type = EMT_BYTE;
-    v.val.u8 = val;
+    auto v = this->find (index, EMT_BYTE);
+    if (v && v->val.u8 == val)
+      return;
+    if ((v = this->reset (index, EMT_BYTE)))
+      v->val.u8 = val;
   }
   
   void
   entity_metadata::put_short (int index, short val)
   {
-    auto& v = this->data[index];
-    v.type = EMT_SHORT;
-    v.val.u16 = (unsigned short)val;
+    auto v = this->find (index, EMT_SHORT);
+    if (v && v->val.u16 == (unsigned short)val)
+      return;
+    if ((v = this->reset (index, EMT_SHORT)))
+      v->val.u16 = (unsigned short)val;
   }
   
   void
   entity_metadata::put_int (int index, int val)
   {
-    auto& v = this->data[index];
-    v.type = EMT_INT;
-    v.val.u32 = (unsigned int)val;
+    auto v = this->find (index, EMT_INT);
+    if (v && v->val.u32 == (unsigned int)val)
+      return;
+    if ((v = this->reset (index, EMT_INT)))
+      v->val.u32 = (unsigned int)val;
   }
   
   void
   entity_metadata::put_float (int index, float val)
   {
-    auto& v = this->data[index];
-    v.type = EMT_FLOAT;
-    v.val.f32 = val;
+    auto v = this->find (index, EMT_FLOAT);
+    if (v && v->val.f32 == val)
+      return;
+    if ((v = this->reset (index, EMT_FLOAT)))
+      v->val.f32 = val;
   }
   
   void
   entity_metadata::put_string (int index, const std::string& str)
   {
-    auto& v = this->data[index];
-    v.type = EMT_STRING;
-    v.val.str = new std::string (str);
+    auto v = this->find (index, EMT_STRING);
+    if (v && *v->val.str == str)
+      return;
+    if ((v = this->reset (index, EMT_STRING)))
+      v->val.str = new std::string (str);
   }
   
   void
   entity_metadata::put_slot (int index, const slot_item& slot)
   {
-    auto& v = this->data[index];
-    v.type = EMT_SLOT;
-    v.val.slot = new slot_item (slot);
+    auto v = this->find (index, EMT_SLOT);
+    if (v && v->val.slot->get_id () == slot.get_id ()
+      && v->val.slot->get_amount () == slot.get_amount ()
+      && v->val.slot->get_damage () == slot.get_damage ())
+      return;
+    if ((v = this->reset (index, EMT_SLOT)))
+      v->val.slot = new slot_item (slot);
   }
   
   void 
   entity_metadata::put_pos (int index, int x, int y, int z)
   {
-    auto& v = this->data[index];
-    v.type = EMT_POS;
-    v.val.pos.x = x;
-    v.val.pos.y = y;
-    v.val.pos.z = z;
+    auto v = this->find (index, EMT_POS);
+    if (v && v->val.pos.x == x && v->val.pos.y == y && v->val.pos.z == z)
+      return;
+    if ((v = this->reset (index, EMT_POS)))
+      {
+        v->val.pos.x = x;
+        v->val.pos.y = y;
+        v->val.pos.z = z;
+      }
   }
   
   void
   entity_metadata::put_rot (int index, float pitch, float yaw, float roll)
   {
-    auto& v = this->data[index];
-    v.type = EMT_ROT;
-    v.val.rot.pitch = pitch;
-    v.val.rot.yaw = yaw;
-    v.val.rot.roll = roll;
+    auto v = this->find (index, EMT_ROT);
+    if (v && v->val.rot.pitch == pitch && v->val.rot.yaw == yaw
+      && v->val.rot.roll == roll)
+      return;
+    if ((v = this->reset (index, EMT_ROT)))
+      {
+        v->val.rot.pitch = pitch;
+        v->val.rot.yaw = yaw;
+        v->val.rot.roll = roll;
+      }
   }
   
   
   
+  void
+  entity_metadata::encode_slot (packet *pack, int index) const
+  {
+    auto& v = this->slots[index];
+    unsigned char t = (unsigned char)v.type;
+    pack->put_byte ((t << 5) | index);
+    
+    switch (v.type)
+      {
+      case EMT_BYTE:
+        pack->put_byte (v.val.u8);
+        break;
+      
+      case EMT_SHORT:
+        pack->put_short (v.val.u16);
+        break;
+      
+      case EMT_INT:
+        pack->put_int (v.val.u32);
+        break;
+      
+      case EMT_FLOAT:
+        pack->put_float (v.val.f32);
+        break;
+      
+      case EMT_STRING:
+        pack->put_varint ((int)v.val.str->length ());
+        pack->put_bytes ((const unsigned char *)v.val.str->c_str (),
+          (int)v.val.str->length ());
+        break;
+      
+      case EMT_SLOT:
+        {
+          auto& slot = *v.val.slot;
+          pack->put_short (slot.get_id ());
+          if (slot.get_id () != EMPTY_SLOT_VALUE)
+            {
+              pack->put_byte ((slot.get_amount () > 255)
+                ? 255 : slot.get_amount ());
+              pack->put_short (slot.get_damage ());
+              pack->put_byte (0); // NBT
+              
+              // TODO: handle extra NBT data
+            }
+        }
+        break;
+      
+      case EMT_POS:
+        pack->put_int (v.val.pos.x);
+        pack->put_int (v.val.pos.y);
+        pack->put_int (v.val.pos.z);
+        break;
+      
+      case EMT_ROT:
+        pack->put_float (v.val.rot.pitch);
+        pack->put_float (v.val.rot.yaw);
+        pack->put_float (v.val.rot.roll);
+        break;
+      }
+  }
+  
   /* 
    * Encodes the contents of the metadata dictionary to the end of the
    * specified packet.
@@ -122,66 +242,29 @@ namespace hc {
   void
   entity_metadata::encode (packet *pack) const
   {
-    for (auto p : this->data)
+    if (!this->cache_valid)
       {
-        unsigned char t = (unsigned char)p.second.type;
-        pack->put_byte ((t << 5) | p.first);
-        
-        switch (p.second.type)
-          {
-          case EMT_BYTE:
-            pack->put_byte (p.second.val.u8);
-            break;
-          
-          case EMT_SHORT:
-            pack->put_short (p.second.val.u16);
-            break;
-          
-          case EMT_INT:
-            pack->put_int (p.second.val.u32);
-            break;
-          
-          case EMT_FLOAT:
-            pack->put_float (p.second.val.f32);
-            break;
-          
-          case EMT_STRING:
-            pack->put_varint ((int)p.second.val.str->length ());
-            pack->put_bytes ((const unsigned char *)p.second.val.str->c_str (),
-              (int)p.second.val.str->length ());
-            break;
-          
-          case EMT_SLOT:
-            {
-              auto& slot = *p.second.val.slot;
-              pack->put_short (slot.get_id ());
-              if (slot.get_id () != EMPTY_SLOT_VALUE)
-                {
-                  pack->put_byte ((slot.get_amount () > 255)
-                    ? 255 : slot.get_amount ());
-                  pack->put_short (slot.get_damage ());
-                  pack->put_byte (0); // NBT
-                  
-                  // TODO: handle extra NBT data
-                }
-            }
-            break;
-          
-          case EMT_POS:
-            pack->put_int (p.second.val.pos.x);
-            pack->put_int (p.second.val.pos.y);
-            pack->put_int (p.second.val.pos.z);
-            break;
-          
-          case EMT_ROT:
-            pack->put_float (p.second.val.rot.pitch);
-            pack->put_float (p.second.val.rot.yaw);
-            pack->put_float (p.second.val.rot.roll);
-            break;
-          }
+        this->cache.reset ();
+        for (int i = 0; i < ENTITY_METADATA_SLOTS; ++i)
+          if (this->used & (1U << i))
+            this->encode_slot (&this->cache, i);
+        this->cache.put_byte (127);
+        this->cache_valid = true;
       }
     
+    pack->put_bytes (this->cache.get_data (), this->cache.get_length ());
+  }
+  
+  /* 
+   * Encodes only the values changed since the last call to clear_changes ()
+   * to the end of the specified packet.
+   */
+  void
+  entity_metadata::encode_changes (packet *pack) const
+  {
+    for (int i = 0; i < ENTITY_METADATA_SLOTS; ++i)
+      if (this->changed & (1U << i))
+        this->encode_slot (pack, i);
     pack->put_byte (127);
   }
 }
-
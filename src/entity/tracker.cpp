@@ -0,0 +1,336 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "entity/tracker.hpp"
+#include "entity/entity.hpp"
+#include "entity/player.hpp"
+#include "player/player.hpp"
+#include "world/world.hpp"
+#include "network/connection.hpp"
+#include "network/packet_builder.hpp"
+#include "network/shared_packet.hpp"
+#include "system/server.hpp"
+#include <algorithm>
+
+
+namespace hc {
+  
+  namespace {
+    
+    inline int
+    _to_fixed (double v)
+    {
+      return (int)(v * 32.0);
+    }
+    
+    inline unsigned char
+    _to_angle (float v)
+    {
+      // wraps negative angles too (converting a negative float straight to
+      // an unsigned char is undefined).
+      return (unsigned char)((int)(v * 256.0f / 360.0f) & 0xFF);
+    }
+    
+    /* 
+     * Adds the packet, as built for the specified player's protocol, to the
+     * list of packets to send once the tracker is unlocked.
+     */
+    inline void
+    _queue (std::vector<std::pair<connection *, shared_packet *>>& out,
+      player *pl, protocol_packet& pack)
+    {
+      connection& conn = pl->get_connection ();
+      out.emplace_back (&conn, pack.get (conn)->grab ());
+    }
+    
+    /* 
+     * Sends all queued packets and clears the list.
+     */
+    void
+    _deliver (std::vector<std::pair<connection *, shared_packet *>>& out)
+    {
+      for (auto& p : out)
+        {
+          p.first->send (p.second);
+          p.second->release ();
+        }
+      out.clear ();
+    }
+  }
+  
+  
+  
+  entity_tracker::entity_tracker (world& w)
+    : w (w)
+    { }
+  
+  
+  
+  /* 
+   * Stores the players that should be able to see the specified entity
+   * in `out' (sorted).
+   */
+  void
+  entity_tracker::find_viewers (entity *ent, std::vector<player *>& out)
+  {
+    out.clear ();
+    
+    // the same square of chunks the players around the entity have loaded.
+    chunk_pos cp = ent->get_pos ();
+    int vrad = this->w.get_server ().get_config ().view_dist;
+    auto nearby = this->w.get_entity_grid ().query (
+      (cp.x - vrad) * 16.0, (cp.z - vrad) * 16.0,
+      (cp.x + vrad + 1) * 16.0, (cp.z + vrad + 1) * 16.0);
+    for (entity *other : nearby)
+      {
+        if (other == ent)
+          continue;
+        
+        player_entity *pent = dynamic_cast<player_entity *> (other);
+        if (pent)
+          out.push_back (pent->get_player ());
+      }
+    
+    std::sort (out.begin (), out.end ());
+  }
+  
+  /* 
+   * Starts tracking the entities passed to add() since the last tick.
+   */
+  void
+  entity_tracker::track_added ()
+  {
+    std::lock_guard<std::mutex> guard { this->add_mtx };
+    for (entity *ent : this->added)
+      {
+        entity_pos pos = ent->get_pos ();
+        tracked_entity& te = this->ents[ent->get_eid ()];
+        te.ent = ent;
+        te.viewers.clear ();
+        te.x = _to_fixed (pos.x);
+        te.y = _to_fixed (pos.y);
+        te.z = _to_fixed (pos.z);
+        te.yaw = _to_angle (pos.yaw);
+        te.pitch = _to_angle (pos.pitch);
+        te.ticks = 0;
+      }
+    this->added.clear ();
+  }
+
+
+
+#define TRACKER_TELEPORT_INTERVAL   100 // ticks between forced teleports
+  
+  /* 
+   * Sends the specified tracked entity's viewers the changes in its
+   * position and rotation since the last tick.
+   */
+  void
+  entity_tracker::send_movement (tracked_entity& te, packet_list& out)
+  {
+    entity_pos pos = te.ent->get_pos ();
+    int x = _to_fixed (pos.x), y = _to_fixed (pos.y), z = _to_fixed (pos.z);
+    unsigned char yaw = _to_angle (pos.yaw), pitch = _to_angle (pos.pitch);
+    
+    ++ te.ticks;
+    int dx = x - te.x, dy = y - te.y, dz = z - te.z;
+    bool moved = dx || dy || dz;
+    bool looked = (yaw != te.yaw) || (pitch != te.pitch);
+    if (!moved && !looked)
+      return;
+    
+    // relative moves are limited to 4 blocks per axis, and periodic
+    // teleports keep rounding errors from building up on the client.
+    bool relative = dx >= -128 && dx <= 127 && dy >= -128 && dy <= 127
+      && dz >= -128 && dz <= 127 && te.ticks < TRACKER_TELEPORT_INTERVAL;
+    
+    int eid = te.ent->get_eid ();
+    bool on_ground = pos.on_ground;
+    protocol_packet move ([=] (packet_builder *builder) -> packet* {
+        if (!relative)
+          return builder->make_entity_teleport (eid, x, y, z, yaw, pitch,
+            on_ground);
+        else if (moved && looked)
+          return builder->make_entity_look_and_relative_move (eid, dx, dy, dz,
+            yaw, pitch, on_ground);
+        else if (moved)
+          return builder->make_entity_relative_move (eid, dx, dy, dz,
+            on_ground);
+        else
+          return builder->make_entity_look (eid, yaw, pitch, on_ground);
+      });
+    protocol_packet head ([=] (packet_builder *builder) -> packet* {
+        return builder->make_entity_head_look (eid, yaw);
+      });
+    
+    for (player *pl : te.viewers)
+      {
+        _queue (out, pl, move);
+        if (yaw != te.yaw)
+          _queue (out, pl, head);
+      }
+    
+    te.x = x;
+    te.y = y;
+    te.z = z;
+    te.yaw = yaw;
+    te.pitch = pitch;
+    if (!relative)
+      te.ticks = 0;
+  }
+  
+  
+  
+  /* 
+   * Sends the specified tracked entity's viewers the metadata values that
+   * changed since the last tick.
+   */
+  void
+  entity_tracker::send_metadata (tracked_entity& te, packet_list& out)
+  {
+    entity *ent = te.ent;
+    std::lock_guard<std::mutex> guard (ent->meta_mtx);
+    if (!ent->meta.has_changes ())
+      return;
+    
+    int eid = ent->get_eid ();
+    const entity_metadata& meta = ent->meta;
+    protocol_packet update ([eid, &meta] (packet_builder *builder) -> packet* {
+        return builder->make_entity_metadata (eid, meta);
+      });
+    for (player *pl : te.viewers)
+      _queue (out, pl, update);
+    
+    ent->meta.clear_changes ();
+  }
+  
+  
+  
+  /* 
+   * Starts tracking the specified entity.  Nearby players will see it
+   * spawned on the next tick.
+   */
+  void
+  entity_tracker::add (entity *ent)
+  {
+    // may be called with a connection locked, so the entity is only queued
+    // here and picked up by the next tick.
+    std::lock_guard<std::mutex> guard { this->add_mtx };
+    this->added.push_back (ent);
+  }
+  
+  /* 
+   * Stops tracking the specified entity, and despawns it from all players
+   * that could see it.
+   */
+  void
+  entity_tracker::remove (entity *ent)
+  {
+    packet_list out;
+    std::unique_lock<std::mutex> guard { this->mtx };
+    
+    {
+      std::lock_guard<std::mutex> add_guard { this->add_mtx };
+      auto aitr = std::find (this->added.begin (), this->added.end (), ent);
+      if (aitr != this->added.end ())
+        this->added.erase (aitr);
+    }
+    
+    auto itr = this->ents.find (ent->get_eid ());
+    if (itr != this->ents.end ())
+      {
+        int eid = ent->get_eid ();
+        protocol_packet destroy ([eid] (packet_builder *builder) -> packet* {
+            return builder->make_destroy_entities (&eid, 1);
+          });
+        for (player *pl : itr->second.viewers)
+          _queue (out, pl, destroy);
+        this->ents.erase (itr);
+      }
+    
+    // the player behind the entity is about to go away, so it can no longer
+    // be a viewer of anything.
+    player_entity *pent = dynamic_cast<player_entity *> (ent);
+    if (pent)
+      {
+        player *pl = pent->get_player ();
+        for (auto& p : this->ents)
+          {
+            auto& viewers = p.second.viewers;
+            auto vitr = std::lower_bound (viewers.begin (), viewers.end (), pl);
+            if (vitr != viewers.end () && *vitr == pl)
+              viewers.erase (vitr);
+          }
+      }
+    
+    // taking the send lock also waits out a tick that is still sending
+    // packets to the player being removed.
+    std::lock_guard<std::mutex> send_guard { this->send_mtx };
+    guard.unlock ();
+    _deliver (out);
+  }
+  
+  
+  
+  /* 
+   * Updates entity visibility and sends movement updates.
+   * Called once per tick.
+   */
+  void
+  entity_tracker::tick ()
+  {
+    std::unique_lock<std::mutex> guard { this->mtx };
+    
+    this->track_added ();
+    for (auto& p : this->ents)
+      {
+        tracked_entity& te = p.second;
+        
+        // players that already see the entity get its movement; ones that
+        // come into range see it spawned in its current position.
+        this->find_viewers (te.ent, this->nearby);
+        this->send_movement (te, this->outbox);
+        this->send_metadata (te, this->outbox);
+        
+        entity *ent = te.ent;
+        int eid = ent->get_eid ();
+        protocol_packet destroy ([eid] (packet_builder *builder) -> packet* {
+            return builder->make_destroy_entities (&eid, 1);
+          });
+        protocol_packet spawn ([ent] (packet_builder *builder) -> packet* {
+            return ent->make_spawn_packet (builder);
+          });
+        
+        auto& viewers = te.viewers;
+        for (player *pl : viewers)
+          if (!std::binary_search (this->nearby.begin (), this->nearby.end (), pl))
+            _queue (this->outbox, pl, destroy);
+        for (player *pl : this->nearby)
+          if (!std::binary_search (viewers.begin (), viewers.end (), pl))
+            _queue (this->outbox, pl, spawn);
+        
+        viewers.swap (this->nearby);
+      }
+    
+    // the packets are sent with the tracker unlocked, but players removed
+    // in the meantime wait for the send lock before they are destroyed.
+    std::lock_guard<std::mutex> send_guard { this->send_mtx };
+    guard.unlock ();
+    _deliver (this->outbox);
+  }
+}
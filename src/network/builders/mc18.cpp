@@ -24,19 +24,22 @@
 #include "entity/metadata.hpp"
 #include <sstream>
 #include <memory>
+#include <vector>
 #include <cmath>
 
 
 namespace hc {
   
-  // adds a length field to the packet at its beginning.
+  // adds a length field to the packet at its beginning, and sets the
+  // packet's priority.
   inline packet*
-  _put_len (packet *pack)
+  _put_len (packet *pack, packet_priority prio = PP_MOVEMENT)
   {
     unsigned char a[5];
     int vl = bin::write_varint (a, pack->get_length ());
     pack->use_reserved (vl);
     pack->put_bytes (a, vl);
+    pack->set_priority (prio);
     return pack;
   }
   
@@ -61,7 +64,7 @@ namespace hc {
     pack->put_varint (0x00); // opcode
     pack->put_string (str.c_str ());
     
-    return _put_len (pack);
+    return _put_len (pack, PP_CONTROL);
   }
   
   packet*
@@ -71,7 +74,7 @@ namespace hc {
     pack->put_varint (0x01); // opcode
     pack->put_long (time);
     
-    return _put_len (pack);
+    return _put_len (pack, PP_CONTROL);
   }
   
   
@@ -99,7 +102,7 @@ namespace hc {
     pack->put_varint (4);
     pack->put_bytes (vtoken, 4);
     
-    return _put_len (pack);
+    return _put_len (pack, PP_CONTROL);
   }
   
   packet*
@@ -111,7 +114,7 @@ namespace hc {
     pack->put_string (uuid.c_str ());
     pack->put_string (username.c_str ());
     
-    return _put_len (pack);
+    return _put_len (pack, PP_CONTROL);
   }
   
   packet*
@@ -129,7 +132,7 @@ namespace hc {
     pack->put_string (ss.str ().c_str ());
     delete js;
     
-    return _put_len (pack);
+    return _put_len (pack, PP_CONTROL);
   }
   
   
@@ -147,7 +150,7 @@ namespace hc {
     pack->put_varint (0x00); // opcode
     pack->put_varint (id);
     
-    return _put_len (pack);
+    return _put_len (pack, PP_CONTROL);
   }
   
   
@@ -166,7 +169,7 @@ namespace hc {
     pack->put_string (level_type.c_str ());
     pack->put_byte (reduced_debug);
     
-    return _put_len (pack);
+    return _put_len (pack, PP_CONTROL);
   }
   
   
@@ -179,7 +182,7 @@ namespace hc {
     pack->put_string (js.c_str ());
     pack->put_byte (pos);
     
-    return _put_len (pack);
+    return _put_len (pack, PP_CHAT);
   }
   
   packet*
@@ -207,7 +210,7 @@ namespace hc {
     pack->put_long (((long long)(x & 0x3FFFFFF) << 38) |
       ((long long)(y & 0xFFF) << 26) | (z & 0x3FFFFFF));
     
-    return _put_len (pack);
+    return _put_len (pack, PP_CONTROL);
   }
   
   
@@ -234,17 +237,23 @@ namespace hc {
   mc18_packet_builder::make_chunk_data (int cx, int cz, bool cont,
     unsigned short mask, chunk *ch)
   {
-    packet *pack = new packet ();
+    int sections = 0;
+    for (int i = 0; i < 16; ++i)
+      if (mask & (1 << i))
+        ++ sections;
+    int data_size = sections * 12288 + (cont ? 256 : 0);
+    
+    // the packet's size is known up front, so it is allocated once and never
+    // has to grow (the length field goes into the reserved space in front).
+    // connections reference the packet's data instead of copying it, so the
+    // array is handed straight to the compressor.
+    int size = 1 + 4 + 4 + 1 + 2 + bin::varint_size (data_size) + data_size;
+    packet *pack = new packet (size);
     pack->put_varint (0x21); // opcode
     pack->put_int (cx);
     pack->put_int (cz);
     pack->put_bool (cont);
     pack->put_short (mask);
-    
-    int data_size = cont ? 256 : 0;
-    for (int i = 0; i < 16; ++i)
-      if (mask & (1 << i))
-        data_size += 12288;
     pack->put_varint (data_size);
     
     for (int i = 0; i < 16; ++i)
@@ -259,7 +268,56 @@ namespace hc {
     if (cont)
       pack->put_bytes (ch->get_biomes (), 256);
     
-    return _put_len (pack);
+    return _put_len (pack, PP_BULK);
+  }
+  
+  packet*
+  mc18_packet_builder::make_map_chunk_bulk (chunk *const *chs, int count)
+  {
+    std::vector<unsigned short> mask (count);
+    
+    // size the packet exactly, as with single chunks.
+    int size = 1 + 1 + bin::varint_size (count) + count * 10;
+    for (int c = 0; c < count; ++c)
+      {
+        mask[c] = 0;
+        for (int i = 0; i < 16; ++i)
+          if (chs[c]->get_sub (i))
+            {
+              mask[c] |= 1 << i;
+              size += 12288;
+            }
+        size += 256;
+      }
+    
+    packet *pack = new packet (size);
+    pack->put_varint (0x26); // opcode
+    pack->put_bool (true);   // sky light sent
+    pack->put_varint (count);
+    for (int c = 0; c < count; ++c)
+      {
+        chunk_pos cp = chs[c]->get_pos ();
+        pack->put_int (cp.x);
+        pack->put_int (cp.z);
+        pack->put_short (mask[c]);
+      }
+    
+    for (int c = 0; c < count; ++c)
+      {
+        chunk *ch = chs[c];
+        for (int i = 0; i < 16; ++i)
+          if (mask[c] & (1 << i))
+            pack->put_bytes (ch->get_sub (i)->types, 8192);
+        for (int i = 0; i < 16; ++i)
+          if (mask[c] & (1 << i))
+            pack->put_bytes (ch->get_sub (i)->bl, 2048);
+        for (int i = 0; i < 16; ++i)
+          if (mask[c] & (1 << i))
+            pack->put_bytes (ch->get_sub (i)->sl, 2048);
+        pack->put_bytes (ch->get_biomes (), 256);
+      }
+    
+    return _put_len (pack, PP_BULK);
   }
   
   packet*
@@ -273,6 +331,43 @@ namespace hc {
     pack->put_short (0);   // primary bitmask
     pack->put_varint (0);  // data size
     
+    return _put_len (pack, PP_BULK);
+  }
+  
+  packet*
+  mc18_packet_builder::make_multi_block_change (int cx, int cz,
+    const unsigned short *changes, int count, chunk *ch)
+  {
+    // every record takes up at most 5 bytes (2 for the position and up to
+    // 3 for the block type).
+    packet *pack = new packet (1 + 4 + 4 + 5 + count * 5);
+    pack->put_varint (0x22); // opcode
+    pack->put_int (cx);
+    pack->put_int (cz);
+    pack->put_varint (count);
+    for (int i = 0; i < count; ++i)
+      {
+        int x = changes[i] & 15;
+        int z = (changes[i] >> 4) & 15;
+        int y = changes[i] >> 8;
+        pack->put_byte ((unsigned char)((x << 4) | z));
+        pack->put_byte ((unsigned char)y);
+        pack->put_varint ((ch->get_id (x, y, z) << 4) | ch->get_meta (x, y, z));
+      }
+    
+    return _put_len (pack);
+  }
+  
+  packet*
+  mc18_packet_builder::make_block_change (int x, int y, int z,
+    unsigned short id, unsigned char meta)
+  {
+    packet *pack = new packet ();
+    pack->put_varint (0x23); // opcode
+    pack->put_long (((long long)(x & 0x3FFFFFF) << 38) |
+      ((long long)(y & 0xFFF) << 26) | (z & 0x3FFFFFF));
+    pack->put_varint ((id << 4) | meta);
+    
     return _put_len (pack);
   }
   
@@ -293,7 +388,7 @@ namespace hc {
     pack->put_string (ss.str ().c_str ());
     delete js;
     
-    return _put_len (pack);
+    return _put_len (pack, PP_CONTROL);
   }
   
   
@@ -305,42 +400,86 @@ namespace hc {
     pack->put_varint (0x46); // opcode
     pack->put_varint (threshold);
     
-    return _put_len (pack);
+    return _put_len (pack, PP_CONTROL);
   }
   
   
   
   packet*
-  mc18_packet_builder::make_player_list_add (uuid_t uuid,
-    const std::string& name, game_mode gm, int ping)
+  mc18_packet_builder::make_player_list_add (const player_list_entry *entries,
+    int count)
   {
-    packet *pack = new packet ();
+    // entries take up to 16 (UUID) + 17 (name) + 5 + 5 + 5 + 1 bytes each.
+    packet *pack = new packet (1 + 1 + 5 + count * 49);
     
     pack->put_varint (0x38); // opcode
     pack->put_varint (0);    // action (add player)
-    pack->put_varint (1);    // number of elements
-    for (int i = 0; i < 16; ++i)
-      pack->put_byte (uuid.parts[i]);
-    pack->put_string (name.c_str ());
-    pack->put_varint (0);    // number of properties
-    pack->put_varint ((gm == GM_CREATIVE) ? 1 : 0);
-    pack->put_varint (ping);
-    pack->put_bool (false);      // has display name
+    pack->put_varint (count);
+    for (int i = 0; i < count; ++i)
+      {
+        auto& ent = entries[i];
+        for (int j = 0; j < 16; ++j)
+          pack->put_byte (ent.uuid.parts[j]);
+        pack->put_string (ent.name);
+        pack->put_varint (0);    // number of properties
+        pack->put_varint ((ent.gm == GM_CREATIVE) ? 1 : 0);
+        pack->put_varint (ent.ping);
+        pack->put_bool (false);  // has display name
+      }
     
     return _put_len (pack);
   }
   
   packet*
-  mc18_packet_builder::make_player_list_remove (uuid_t uuid,
-    const std::string& name)
+  mc18_packet_builder::make_player_list_update_gm (
+    const player_list_entry *entries, int count)
   {
-    packet *pack = new packet ();
+    packet *pack = new packet (1 + 1 + 5 + count * 17);
+    
+    pack->put_varint (0x38); // opcode
+    pack->put_varint (1);    // action (update gamemode)
+    pack->put_varint (count);
+    for (int i = 0; i < count; ++i)
+      {
+        for (int j = 0; j < 16; ++j)
+          pack->put_byte (entries[i].uuid.parts[j]);
+        pack->put_varint ((entries[i].gm == GM_CREATIVE) ? 1 : 0);
+      }
+    
+    return _put_len (pack);
+  }
+  
+  packet*
+  mc18_packet_builder::make_player_list_update_ping (
+    const player_list_entry *entries, int count)
+  {
+    packet *pack = new packet (1 + 1 + 5 + count * 21);
+    
+    pack->put_varint (0x38); // opcode
+    pack->put_varint (2);    // action (update latency)
+    pack->put_varint (count);
+    for (int i = 0; i < count; ++i)
+      {
+        for (int j = 0; j < 16; ++j)
+          pack->put_byte (entries[i].uuid.parts[j]);
+        pack->put_varint (entries[i].ping);
+      }
+    
+    return _put_len (pack);
+  }
+  
+  packet*
+  mc18_packet_builder::make_player_list_remove (
+    const player_list_entry *entries, int count)
+  {
+    packet *pack = new packet (1 + 1 + 5 + count * 16);
     
     pack->put_varint (0x38); // opcode
     pack->put_varint (4);    // action (remove player)
-    pack->put_varint (1);    // number of elements
-    for (int i = 0; i < 16; ++i)
-      pack->put_byte (uuid.parts[i]);
+    pack->put_varint (count);
+    for (int i = 0; i < count; ++i)
+      for (int j = 0; j < 16; ++j)
+        pack->put_byte (entries[i].uuid.parts[j]);
     
     return _put_len (pack);
   }
@@ -368,5 +507,105 @@ namespace hc {
     
     return _put_len (pack);
   }
+  
+  
+  
+  packet*
+  mc18_packet_builder::make_destroy_entities (const int *eids, int count)
+  {
+    packet *pack = new packet (1 + 5 + count * 5);
+    pack->put_varint (0x13); // opcode
+    pack->put_varint (count);
+    for (int i = 0; i < count; ++i)
+      pack->put_varint (eids[i]);
+    
+    return _put_len (pack);
+  }
+  
+  packet*
+  mc18_packet_builder::make_entity_relative_move (int eid, int dx, int dy,
+    int dz, bool on_ground)
+  {
+    packet *pack = new packet ();
+    pack->put_varint (0x15); // opcode
+    pack->put_varint (eid);
+    pack->put_byte ((unsigned char)dx);
+    pack->put_byte ((unsigned char)dy);
+    pack->put_byte ((unsigned char)dz);
+    pack->put_bool (on_ground);
+    
+    return _put_len (pack);
+  }
+  
+  packet*
+  mc18_packet_builder::make_entity_look (int eid, unsigned char yaw,
+    unsigned char pitch, bool on_ground)
+  {
+    packet *pack = new packet ();
+    pack->put_varint (0x16); // opcode
+    pack->put_varint (eid);
+    pack->put_byte (yaw);
+    pack->put_byte (pitch);
+    pack->put_bool (on_ground);
+    
+    return _put_len (pack);
+  }
+  
+  packet*
+  mc18_packet_builder::make_entity_look_and_relative_move (int eid, int dx,
+    int dy, int dz, unsigned char yaw, unsigned char pitch, bool on_ground)
+  {
+    packet *pack = new packet ();
+    pack->put_varint (0x17); // opcode
+    pack->put_varint (eid);
+    pack->put_byte ((unsigned char)dx);
+    pack->put_byte ((unsigned char)dy);
+    pack->put_byte ((unsigned char)dz);
+    pack->put_byte (yaw);
+    pack->put_byte (pitch);
+    pack->put_bool (on_ground);
+    
+    return _put_len (pack);
+  }
+  
+  packet*
+  mc18_packet_builder::make_entity_teleport (int eid, int x, int y, int z,
+    unsigned char yaw, unsigned char pitch, bool on_ground)
+  {
+    packet *pack = new packet (32);
+    pack->put_varint (0x18); // opcode
+    pack->put_varint (eid);
+    pack->put_int (x);
+    pack->put_int (y);
+    pack->put_int (z);
+    pack->put_byte (yaw);
+    pack->put_byte (pitch);
+    pack->put_bool (on_ground);
+    
+    return _put_len (pack);
+  }
+  
+  packet*
+  mc18_packet_builder::make_entity_head_look (int eid, unsigned char yaw)
+  {
+    packet *pack = new packet ();
+    pack->put_varint (0x19); // opcode
+    pack->put_varint (eid);
+    pack->put_byte (yaw);
+    
+    return _put_len (pack);
+  }
+  
+  packet*
+  mc18_packet_builder::make_entity_metadata (int eid,
+    const entity_metadata& meta)
+  {
+    packet *pack = new packet ();
+    pack->put_varint (0x1C); // opcode
+    pack->put_varint (eid);
+    meta.encode_changes (pack);
+    
+    return _put_len (pack);
+  }
 }
 
@@ -0,0 +1,186 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "network/capture.hpp"
+#include "util/binary.hpp"
+#include <cstdio>
+#include <cstring>
+
+
+namespace hc {
+  
+  capture_writer::~capture_writer ()
+  {
+    this->close ();
+  }
+  
+  
+  
+  /* 
+   * Creates a capture file for a new session at the specified path.
+   * Returns false if the file could not be created.
+   */
+  bool
+  capture_writer::open (const std::string& path, const char *ip,
+    unsigned char flags)
+  {
+    this->fs.open (path, std::ios_base::out | std::ios_base::binary
+      | std::ios_base::trunc);
+    if (!this->fs)
+      return false;
+    this->path = path;
+    
+    long long start = std::chrono::duration_cast<std::chrono::milliseconds> (
+      std::chrono::system_clock::now ().time_since_epoch ()).count ();
+    this->last = std::chrono::steady_clock::now ();
+    
+    unsigned char hdr[16];
+    std::memcpy (hdr, "HCAP", 4);
+    hdr[4] = CAPTURE_VERSION;
+    hdr[5] = flags;
+    bin::write_long_be (hdr + 6, (unsigned long long)start);
+    this->fs.write ((const char *)hdr, 14);
+    
+    unsigned char ip_len = (unsigned char)std::strlen (ip);
+    this->fs.put ((char)ip_len);
+    this->fs.write (ip, ip_len);
+    return true;
+  }
+  
+  
+  
+  /* 
+   * Appends the specified delimited packet to the capture file, stamped
+   * with the current time.
+   */
+  void
+  capture_writer::record (const unsigned char *data, unsigned int len)
+  {
+    if (!this->fs.is_open ())
+      return;
+    
+    auto now = std::chrono::steady_clock::now ();
+    long long delta = std::chrono::duration_cast<std::chrono::microseconds> (
+      now - this->last).count ();
+    this->last = now;
+    
+    unsigned char vl[10];
+    int vl_len = bin::write_varlong (vl, (unsigned long long)delta);
+    this->fs.write ((const char *)vl, vl_len);
+    this->fs.write ((const char *)data, len);
+  }
+  
+  
+  
+  /* 
+   * Closes the capture file.  The file is deleted unless `keep' is true
+   * (e.g. for sessions that never logged in).
+   */
+  void
+  capture_writer::close (bool keep)
+  {
+    if (!this->fs.is_open ())
+      return;
+    
+    this->fs.close ();
+    if (!keep)
+      std::remove (this->path.c_str ());
+  }
+
+
+
+//------------------------------------------------------------------------------
+  
+  /* 
+   * Opens the specified capture file and reads its header.
+   * Returns false if the file could not be opened, or is not a capture
+   * file.
+   */
+  bool
+  capture_reader::open (const std::string& path)
+  {
+    this->fs.open (path, std::ios_base::in | std::ios_base::binary);
+    if (!this->fs)
+      return false;
+    
+    unsigned char hdr[15];
+    if (!this->fs.read ((char *)hdr, sizeof hdr)
+      || std::memcmp (hdr, "HCAP", 4) != 0 || hdr[4] != CAPTURE_VERSION)
+      return false;
+    
+    this->flags = hdr[5];
+    this->start = bin::read_long_be (hdr + 6);
+    this->time = 0;
+    
+    char ip[256];
+    if (!this->fs.read (ip, hdr[14]))
+      return false;
+    this->ip.assign (ip, hdr[14]);
+    return true;
+  }
+  
+  
+  
+  /* 
+   * Reads the next record into `rec'.
+   * Returns false at the end of the file (or if the rest of it is cut off).
+   */
+  bool
+  capture_reader::next (record& rec)
+  {
+    // time delta
+    unsigned char vl[10];
+    int i;
+    for (i = 0; i < 10; ++i)
+      {
+        int c = this->fs.get ();
+        if (c == EOF)
+          return false;
+        vl[i] = (unsigned char)c;
+        if (!(vl[i] & 0x80))
+          break;
+      }
+    if (i == 10)
+      return false;
+    this->time += bin::read_varlong (vl);
+    rec.time = this->time;
+    
+    // packet length
+    unsigned char hdr[5];
+    for (i = 0; i < 5; ++i)
+      {
+        int c = this->fs.get ();
+        if (c == EOF)
+          return false;
+        hdr[i] = (unsigned char)c;
+        if (!(hdr[i] & 0x80))
+          break;
+      }
+    if (i == 5)
+      return false;
+    
+    int hdr_len;
+    int len = bin::read_varint (hdr, &hdr_len);
+    if (len < 0)
+      return false;
+    
+    rec.data.resize (hdr_len + len);
+    std::memcpy (rec.data.data (), hdr, hdr_len);
+    return (bool)this->fs.read ((char *)rec.data.data () + hdr_len, len);
+  }
+}
@@ -21,6 +21,7 @@
 #include "system/logger.hpp"
 #include "util/binary.hpp"
 #include "network/packet.hpp"
+#include "network/shared_packet.hpp"
 #include "network/packet_delimiter.hpp"
 #include "network/packet_handler.hpp"
 #include "network/packet_transformer.hpp"
@@ -31,6 +32,19 @@
 #include <event2/buffer.h>
 #include <cstring>
 #include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <sstream>
+
+#ifdef WIN32
+# include "os/windows/stdafx.hpp"
+#else
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+#endif
 
 
 namespace hc {
@@ -41,15 +55,33 @@ namespace hc {
     this->sock = sock;
     std::strcpy (this->ip, ip);
     this->disconnected = false;
+    this->detached = false;
+    this->bev = nullptr;
     this->proto = nullptr;
     this->can_send = true;
     this->ftb = evbuffer_new ();
-    this->init_pack = nullptr;
+    this->otb = evbuffer_new ();
+    this->flush_pending = false;
+    this->drain_dc = false;
+    this->corked = false;
+    this->last_tmask = 0;
+    this->drr_lane = 0;
+    for (int i = 0; i < PP_COUNT; ++i)
+      this->drr_deficit[i] = 0;
+    this->qbytes = 0;
+    this->sunk_bytes = 0;
+    this->over_budget = false;
     this->disconnect_req = false;
     this->next_packet_id = 1;
     this->pl = nullptr;
+    this->nev = nullptr;
+    this->w = nullptr;
+    for (int i = 0; i < CONN_DEADLINE_COUNT; ++i)
+      this->deadlines[i].set_callback ([this, i] { this->on_deadline (i); });
     
-    this->pseq = srv.get_thread_pool ().create_seq ();
+    this->inbox_head = this->inbox_tail = nullptr;
+    this->inbox_open = true;
+    this->draining = false;
   }
   
   connection::~connection ()
@@ -57,12 +89,14 @@ namespace hc {
     this->disconnect ();
     
     delete this->proto;
-    srv.get_thread_pool ().release_seq (this->pseq, [] (void *) { });
+    this->clear_inbox ();
     
-    bufferevent_free (this->bev);
+    if (this->bev)
+      bufferevent_free (this->bev);
     for (auto tb : this->tbs)
       evbuffer_free (tb);
     evbuffer_free (this->ftb);
+    evbuffer_free (this->otb);
   }
   
   
@@ -70,7 +104,7 @@ namespace hc {
   /* 
    * Does all the work of disconnecting the connection.
    * disconnect() merely makes disconnect_() get called by the connection's
-   * timer event to prevent locking the bufferevent.
+   * notification event to prevent locking the bufferevent.
    */
   void
   connection::disconnect_ ()
@@ -80,21 +114,46 @@ namespace hc {
       return;
     
     // free unsent packets
-    {
-      for (packet_container *cont : this->outq)
+    for (auto& lane : this->lanes)
+      {
+        for (packet_container *cont : lane)
+          {
+            evbuffer_free (cont->buf);
+            delete cont;
+          }
+        lane.clear ();
+      }
+    this->barriers.clear ();
+    
+    if (!this->detached)
+      {
+        event_free (this->nev);
+        bufferevent_disable (this->bev, EV_READ | EV_WRITE);
+        -- this->w->stats.conns;
+        
+        for (auto& dl : this->deadlines)
+          this->w->timers->cancel (&dl);
         {
-          delete cont->pack;
-          delete cont;
+          std::lock_guard<std::mutex> guard { this->w->conns_mtx };
+          auto& conns = this->w->conns;
+          auto itr = std::find (conns.begin (), conns.end (), this);
+          if (itr != conns.end ())
+            {
+              *itr = conns.back ();
+              conns.pop_back ();
+            }
         }
-    }
+        
+        // whatever is still queued is about to be thrown away
+        evbuffer_remove_cb (bufferevent_get_output (this->bev),
+          &connection::on_output_drained, this);
+        this->srv.account_queued (- this->qbytes.exchange (0));
+      }
     
-    event_free (this->tev);
-    bufferevent_disable (this->bev, EV_READ | EV_WRITE);
+    this->clear_inbox ();
     
-    this->srv.get_thread_pool ().disable_seq (this->pseq,
-      [] (void *ptr) {
-        delete static_cast<packet_reader *> (ptr);
-      });
+    // only sessions that got as far as logging in are worth replaying
+    this->cap.close (this->pl != nullptr);
     
     this->proto->get_handler ()->disconnect ();
     
@@ -109,7 +168,33 @@ namespace hc {
   void
   connection::disconnect ()
   {
+    std::lock_guard<std::recursive_mutex> dc_guard { this->dc_mtx };
     this->disconnect_req = true;
+    
+    // detached connections have no event loop to defer to.
+    if (this->detached)
+      this->disconnect_ ();
+    else
+      this->notify ();
+  }
+  
+  
+  
+  /* 
+   * Wakes up the event loop that the connection is handled by, and makes
+   * it process pending writes and disconnection requests.
+   * Can be called from any thread.
+   */
+  void
+  connection::notify ()
+  {
+    std::lock_guard<std::recursive_mutex> dc_guard { this->dc_mtx };
+    if (this->disconnected || !this->nev)
+      return;
+    
+    // libevent's threading support takes care of waking the event base up
+    // if this is called from outside of the worker thread.
+    event_active (this->nev, EV_WRITE, 0);
   }
   
   
@@ -117,25 +202,144 @@ namespace hc {
    * Starts handling reading and writing.
    */
   void
-  connection::start_io ()
+  connection::start_io (server::worker *pref)
   {
     if (!this->proto)
       throw std::runtime_error ("connection::start_io: no protocol");
     
-    server::worker *w = this->srv.min_worker ();
+    std::lock_guard<std::recursive_mutex> dc_guard { this->dc_mtx };
+    
+    server::worker *w = this->srv.min_worker (pref);
+    ++ w->stats.conns;
+    this->w = w;
     this->evb = w->evbase;
     
-    this->rbuf_len = 0;
+    this->nev = event_new (w->evbase, -1, 0, &connection::on_notify, this);
+    
+    int nodelay = this->srv.get_config ().tcp_nodelay ? 1 : 0;
+    setsockopt (this->sock, IPPROTO_TCP, TCP_NODELAY,
+      (const char *)&nodelay, sizeof nodelay);
     
     this->bev = bufferevent_socket_new (this->evb, this->sock,
       BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE);
     bufferevent_setcb (this->bev, &connection::on_read, &connection::on_write,
       &connection::on_event, this);
+    evbuffer_add_cb (bufferevent_get_output (this->bev),
+      &connection::on_output_drained, this);
+    
+    // refill the output buffer once half of the send window has been written.
+    int window = this->srv.get_config ().send_window;
+    if (window > 0)
+      bufferevent_setwatermark (this->bev, EV_WRITE, window / 2, 0);
     bufferevent_enable (this->bev, EV_READ | EV_WRITE);
     
-    struct timeval tv = { 0, 10000 };
-    this->tev = evtimer_new (w->evbase, &connection::on_time, this);
-    evtimer_add (this->tev, &tv);
+    // the worker's tick drives the connection from now on.
+    {
+      std::lock_guard<std::mutex> guard { w->conns_mtx };
+      w->conns.push_back (this);
+    }
+    this->set_deadline (CONN_DEADLINE_LOGIN, this->srv.get_config ().login_timeout);
+    
+    if (this->srv.get_config ().capture)
+      this->start_capture ();
+  }
+  
+  /* 
+   * Sets the connection up without a socket or a worker, to have packets
+   * fed to its handler directly (e.g. when replaying a capture).  Packets
+   * sent through the connection are fully transformed, counted, and then
+   * discarded.
+   */
+  void
+  connection::start_detached ()
+  {
+    if (!this->proto)
+      throw std::runtime_error ("connection::start_detached: no protocol");
+    
+    std::lock_guard<std::recursive_mutex> dc_guard { this->dc_mtx };
+    this->detached = true;
+  }
+  
+  /* 
+   * Starts recording the packets received by the connection to a new
+   * file in the server's capture directory.
+   */
+  void
+  connection::start_capture ()
+  {
+    auto& cfg = this->srv.get_config ();
+    
+    char stamp[32];
+    std::time_t t = std::time (nullptr);
+    std::strftime (stamp, sizeof stamp, "%Y%m%d-%H%M%S", std::localtime (&t));
+    
+    std::ostringstream ss;
+    ss << cfg.capture_dir << "/" << stamp << "-" << this->ip << "-"
+       << this->srv.next_capture_id () << ".hcap";
+    
+    unsigned char flags = cfg.encryption ? CAPTURE_F_ENCRYPTED : 0;
+    if (!this->cap.open (ss.str (), this->ip, flags))
+      log (LT_WARNING) << "Could not create capture file `" << ss.str () << "'" << std::endl;
+  }
+  
+  /* 
+   * Called by the connection's worker once every tick (20ms).
+   */
+  void
+  connection::tick ()
+  {
+    std::lock_guard<std::recursive_mutex> dc_guard { this->dc_mtx };
+    if (this->disconnected || this->disconnect_req)
+      return;
+    
+    if (this->proto->get_handler ())
+      this->proto->get_handler ()->tick ();
+  }
+  
+  
+  
+  /* 
+   * Disconnects the connection if the specified deadline is not cleared
+   * within the given amount of milliseconds.  Setting a deadline that is
+   * already pending pushes it back.
+   */
+  void
+  connection::set_deadline (int which, int ms)
+  {
+    std::lock_guard<std::recursive_mutex> dc_guard { this->dc_mtx };
+    if (this->disconnected || !this->w || ms <= 0)
+      return;
+    
+    this->w->timers->schedule (&this->deadlines[which], ms);
+  }
+  
+  /* 
+   * Cancels the specified deadline.
+   */
+  void
+  connection::clear_deadline (int which)
+  {
+    std::lock_guard<std::recursive_mutex> dc_guard { this->dc_mtx };
+    if (this->disconnected || !this->w)
+      return;
+    
+    this->w->timers->cancel (&this->deadlines[which]);
+  }
+  
+  /* 
+   * Called from the worker's timer wheel when the specified deadline
+   * expires.
+   */
+  void
+  connection::on_deadline (int which)
+  {
+    std::lock_guard<std::recursive_mutex> dc_guard { this->dc_mtx };
+    if (this->disconnected || this->disconnect_req)
+      return;
+    
+    log (LT_WARNING) << "@" << this->ip << " timed out ("
+      << ((which == CONN_DEADLINE_LOGIN) ? "login" : "keep-alive") << ")" << std::endl;
+    this->disconnect ();
   }
   
   
@@ -148,119 +352,205 @@ namespace hc {
   {
     struct evbuffer *input = bufferevent_get_input (this->bev);
     
-    bool needed = false;
+    // incoming data goes through the transformers in reverse order.  every
+    // stage keeps its pending input in its own buffer, and writes its output
+    // straight into the buffer of the next stage (or the final buffer).
+    struct evbuffer *inbuf = nullptr;
     auto trs = this->proto->get_transformers ();
-    for (auto tr : trs)
-      if (tr->is_on ())
-        {
-          needed = true;
-          break;
-        }
-    if (!needed)
-      {
-        // move straight to final data buffer
-        evbuffer_add_buffer (this->ftb, input);
-        return;
-      }
-    
-    struct evbuffer *lastbuf = input;
     for (int i = (int)trs.size () - 1; i >= 0; --i)
       {
         auto tr = trs[i];
         if (!tr->is_on ())
           continue;
         
-        evbuffer_add_buffer (this->tbs[i], lastbuf);
+        if (!inbuf)
+          evbuffer_add_buffer (this->tbs[i], input);
         
-        // transform as much data as possible
-        
-        int from_len = (int)evbuffer_get_length (this->tbs[i]);
-        unsigned char *from = new unsigned char[from_len];
-        evbuffer_remove (this->tbs[i], from, from_len);
+        struct evbuffer *nextbuf = this->ftb;
+        for (int j = i - 1; j >= 0; --j)
+          if (trs[j]->is_on ())
+            {
+              nextbuf = this->tbs[j];
+              break;
+            }
         
-        int res = tr->in_enough (from, from_len);
-        if (res == -1)
+        if (!tr->transform_in (this->tbs[i], nextbuf))
           {
-            // invalid data
-            delete[] from;
             this->disconnect ();
             return;
           }
-        else if (res != 1)
+        
+        inbuf = nextbuf;
+      }
+    
+    if (!inbuf)
+      {
+        // move straight to final data buffer
+        evbuffer_add_buffer (this->ftb, input);
+      }
+  }
+  
+  /* 
+   * Appends the specified chain of decoded packets to the connection's
+   * inbox, and queues a drain job if there is none in flight.
+   */
+  void
+  connection::post_packets (packet_block *head, packet_block *tail)
+  {
+    {
+      std::lock_guard<std::mutex> guard { this->inbox_mtx };
+      if (this->inbox_open)
+        {
+          if (this->inbox_tail)
+            this->inbox_tail->next = head;
+          else
+            this->inbox_head = head;
+          this->inbox_tail = tail;
+          
+          if (this->draining)
+            return; // the running job will pick them up
+          this->draining = true;
+          head = nullptr;
+        }
+    }
+    
+    if (head)
+      {
+        // the connection is going down.
+        while (head)
           {
-            // need more data
-            evbuffer_add (this->tbs[i], from, from_len);
-            delete[] from;
-            break;
+            packet_block *next = head->next;
+            this->rpool.release (head);
+            head = next;
           }
+        return;
+      }
+    
+    bool queued = this->srv.get_thread_pool ().enqueue (
+      [this] (void *) {
+        this->drain_inbox ();
+      }, nullptr, this->refc);
+    if (!queued)
+      {
+        std::lock_guard<std::mutex> guard { this->inbox_mtx };
+        this->draining = false;
+      }
+  }
+  
+  /* 
+   * Handles packets from the inbox until it is empty.
+   * Runs in the server's thread pool.
+   */
+  void
+  connection::drain_inbox ()
+  {
+    for (;;)
+      {
+        // take everything that has arrived so far in one go.
+        packet_block *block;
+        {
+          std::lock_guard<std::mutex> guard { this->inbox_mtx };
+          block = this->inbox_head;
+          this->inbox_head = this->inbox_tail = nullptr;
+          if (!block)
+            {
+              this->draining = false;
+              return;
+            }
+        }
         
-        int to_len = 0;
-        int consumed = 0;
-        unsigned char *to = nullptr;
-        tr->transform_in (from, from_len, &to, &to_len, &consumed);
-        
-        struct evbuffer *nextbuf = nullptr;
-        for (int j = i - 1; j >= 0; --j)
-          if (trs[j]->is_on ())
-            nextbuf = this->tbs[j];
-        if (!nextbuf)
-          nextbuf = this->ftb;
-        evbuffer_add (nextbuf, to, to_len);
-        
-        evbuffer_add (this->tbs[i], from + consumed, from_len - consumed);
-        delete[] from;
-        delete[] to;
-        
-        lastbuf = this->tbs[i];
+        while (block)
+          {
+            packet_block *next = block->next;
+            block->next = nullptr;
+            if (this->inbox_open)
+              this->proto->get_handler ()->handle (block->reader);
+            this->rpool.release (block);
+            block = next;
+          }
       }
   }
   
   /* 
-   * Applies the protocol's out transformers to the contents of the specified
-   * packet.
+   * Returns all packets still held in the inbox to the pool.
    */
   void
-  connection::apply_out_transformations (packet *pack)
+  connection::clear_inbox ()
   {
-    int on_count = 0;
-    auto trs = this->proto->get_transformers ();
-    for (auto tr : trs)
-      if (tr->is_on ())
-        ++ on_count;
-    if (on_count == 0)
-      return;
+    std::lock_guard<std::mutex> guard { this->inbox_mtx };
+    this->inbox_open = false;
+    
+    packet_block *block = this->inbox_head;
+    this->inbox_head = this->inbox_tail = nullptr;
+    while (block)
+      {
+        packet_block *next = block->next;
+        this->rpool.release (block);
+        block = next;
+      }
+  }
+  
+  
+  
+  /* 
+   * Applies the protocol's out transformers in the range [from, to) to the
+   * packet data held in the specified buffer, replacing its contents with
+   * the transformed data.  Only transformers whose bit is set in `mask' are
+   * considered.
+   * Returns false on failure.
+   */
+  bool
+  connection::apply_out_transformations (struct evbuffer *buf, int from,
+    int to, unsigned int mask)
+  {
+    auto& trs = this->proto->get_transformers ();
+    if (to < 0)
+      to = (int)trs.size ();
     
-    int ti = 0;
-    unsigned char *init_data = const_cast<unsigned char *> (pack->get_data ());
-    unsigned char *last_data = init_data;
-    int last_len = pack->get_length ();
-    for (int i = 0; i < on_count; ++i)
+    // every stage drains the buffer into otb, and the result is moved back
+    // (moving chains between evbuffers does not copy any data).
+    for (int i = from; i < to; ++i)
       {
-        while (!trs[ti]->is_on ())
-          ++ ti;
+        auto tr = trs[i];
+        if (!tr->is_on () || !(mask & (1u << i)))
+          continue;
         
-        auto tr = trs[ti];
-        int out_len = 0;
-        unsigned char *out = nullptr;
-        if (!tr->transform_out (last_data, last_len, &out, &out_len))
+        if (!tr->transform_out (buf, this->otb))
           {
-            log (LT_ERROR) << "Could not apply transformation to packet, disconnecting player." << std::endl;
-            delete[] out;
-            if (last_data != init_data)
-              delete[] last_data;
-            return;
+            evbuffer_drain (this->otb, evbuffer_get_length (this->otb));
+            return false;
           }
         
-        if (last_data != init_data)
-          delete[] last_data;
-        last_data = out;
-        last_len = out_len;
-        ++ ti;
+        evbuffer_add_buffer (buf, this->otb);
       }
     
-    pack->reset ();
-    pack->put_bytes (last_data, last_len);
-    delete[] last_data;
+    return true;
+  }
+  
+  /* 
+   * Returns the index of the first active stateful out transformer (or the
+   * number of transformers if there is none), and stores a signature that
+   * identifies the active stateless transformers before it in `sig'.
+   */
+  int
+  connection::stateless_prefix (unsigned long long *sig)
+  {
+    auto& trs = this->proto->get_transformers ();
+    
+    *sig = 0;
+    int i;
+    for (i = 0; i < (int)trs.size (); ++i)
+      {
+        auto tr = trs[i];
+        if (!tr->is_on ())
+          continue;
+        if (tr->is_stateful ())
+          break;
+        
+        *sig = (*sig * 31) + ((unsigned long long)i << 32) + tr->signature () + 1;
+      }
+    
+    return i;
   }
   
   
@@ -277,57 +567,110 @@ namespace hc {
     int len = (int)evbuffer_get_length (input);
     if (len <= 0)
       { conn->disconnect (); return; }
+    conn->w->stats.bytes += len;
     
     conn->apply_in_transformations ();
+    if (conn->disconnect_req)
+      return;
     
-    do
+    // decoded packets are collected into a chain, and handed over to the
+    // packet handler in a single batch.
+    packet_block *head = nullptr, *tail = nullptr;
+    
+    // cheap packets may be handled right here, as long as no handler job is
+    // in flight that they could overtake.
+    bool idle;
+    {
+      std::lock_guard<std::mutex> guard { conn->inbox_mtx };
+      idle = !conn->draining && !conn->inbox_head;
+    }
+    
+    packet_delimiter *delim = conn->proto->get_delimiter ();
+    int max_size = conn->srv.get_config ().max_packet_size;
+    for (;;)
       {
         len = (int)evbuffer_get_length (conn->ftb);
+        if (len <= 0)
+          break;
         
-        int rem = conn->proto->get_delimiter ()->remaining (conn->rbuf, conn->rbuf_len);
-        if (rem < 0)
+        // determine the packet's size by looking at its first few bytes.
+        int hlen = (len < 5) ? len : 5;
+        const unsigned char *hdr = evbuffer_pullup (conn->ftb, hlen);
+        int got = 1, rem;
+        for (;;)
+          {
+            rem = delim->remaining (hdr, got);
+            if (rem <= 0 || got + rem > hlen)
+              break;
+            got += rem;
+          }
+        
+        int size = got + rem;
+        if (rem < 0 || size <= 0)
           {
             conn->log (LT_WARNING)
               << "Received invalid packet from @" << conn->get_ip () << std::endl;
             conn->disconnect ();
-            return;
+            break;
           }
-        else if (rem == 0)
+        else if (size > max_size)
           {
-            // finished reading packet
-            if (conn->proto->get_handler ())
-              {
-                // execute handler in different (pooled) thread.
-                packet_reader *reader = new packet_reader (conn->rbuf, conn->rbuf_len, true);
-                conn->srv.get_thread_pool ().enqueue_seq (conn->pseq,
-                  [conn] (void *ptr) {
-                    auto reader = static_cast<packet_reader *> (ptr);
-                    conn->proto->get_handler ()->handle (*reader);
-                    delete reader;
-                  }, reader);
-              }
-            
-            conn->rbuf_len = 0;
+            conn->log (LT_WARNING)
+              << "Packet received from @" << conn->get_ip () << " too big" << std::endl;
+            conn->disconnect ();
+            break;
           }
-        else
+        else if (size > len)
+          break; // wait for the rest of the packet
+        
+        // read the packet into a pooled block, that is returned to the pool
+        // once the packet has been handled.
+        if (!conn->srv.get_packet_limiter ().consume (conn->ip))
           {
-            if ((conn->rbuf_len + rem) > READ_BUFFER_SIZE)
-              {
-                conn->log (LT_WARNING)
-                  << "Packet received from @" << conn->get_ip () << " too big" << std::endl;
-                conn->disconnect ();
-                return;
-              }
+            conn->log (LT_WARNING)
+              << "@" << conn->get_ip () << " is sending packets too fast" << std::endl;
+            conn->disconnect ();
+            break;
+          }
+        
+        packet_block *block = conn->rpool.acquire (size);
+        if (!block)
+          { conn->disconnect (); break; }
+        evbuffer_remove (conn->ftb, block->data, size);
+        if (conn->cap.is_open ())
+          conn->cap.record (block->data, size);
+        if (!conn->proto->get_handler ())
+          {
+            conn->rpool.release (block);
+            continue;
+          }
+        block->reader.reset (block->data, size);
+        
+        packet_handler *handler = conn->proto->get_handler ();
+        if (idle && !head && handler->is_inline_safe (block->reader))
+          {
+            handler->handle (block->reader);
+            conn->rpool.release (block);
+            if (conn->disconnect_req)
+              break;
             
-            if (rem > len)
-              rem = len;
-            int n = evbuffer_remove (conn->ftb, conn->rbuf + conn->rbuf_len, rem);
-            if (n < 0)
-              { conn->disconnect (); return; }
-            conn->rbuf_len += n;
+            // the handler might have switched the connection's protocol.
+            delim = conn->proto->get_delimiter ();
+            continue;
           }
+        
+        if (tail)
+          tail->next = block;
+        else
+          head = block;
+        tail = block;
       }
-    while (len > 0);
+    
+    // execute handlers in a different (pooled) thread.  packets that were
+    // read before an error are still handled, like they would have been had
+    // they arrived in an earlier read.
+    if (head)
+      conn->post_packets (head, tail);
   }
   
   void
@@ -335,30 +678,20 @@ namespace hc {
   {
     connection *conn = static_cast<connection *> (ctx);
     std::lock_guard<std::recursive_mutex> dc_guard { conn->dc_mtx };
-    if (conn->outq.empty ())
-      return;
-    
-    packet_container *cont = conn->outq.front ();
-    if (cont == conn->init_pack) // hasn't been sent yet
+    if (conn->disconnected)
       return;
     
-    packet *pack = cont->pack;
-    unsigned int flags = cont->flags;
-    conn->outq.pop_front ();
-    delete cont;
-    delete pack;
-    
-    if (flags & CONN_SEND_DISCONNECT)
-      {
-        conn->disconnect ();
-        return;
-      }
+    // the output buffer has dropped below its low watermark, refill it from
+    // the priority lanes.
+    conn->flush ();
     
-    if (!conn->outq.empty ())
+    if (evbuffer_get_length (bufferevent_get_output (bev)) == 0)
       {
-        cont = conn->outq.front ();
-        pack = cont->pack;
-        bufferevent_write (conn->bev, pack->get_data (), pack->get_length ());
+        // fully drained, push out any partial frame.
+        conn->set_cork (false);
+        
+        if (conn->drain_dc)
+          conn->disconnect ();
       }
   }
   
@@ -370,42 +703,189 @@ namespace hc {
   }
   
   void
-  connection::on_time (evutil_socket_t fd, short events, void *ctx)
+  connection::on_notify (evutil_socket_t fd, short events, void *ctx)
   {
     connection *conn = static_cast<connection *> (ctx);
     std::lock_guard<std::recursive_mutex> dc_guard { conn->dc_mtx };
+    if (conn->disconnected)
+      return;
+    
     bufferevent_lock (conn->bev);
     
     if (conn->disconnect_req)
       {
-        event_del (conn->tev);
         bufferevent_unlock (conn->bev);
         conn->disconnect_ ();
         return;
       }
     
-    if (conn->init_pack)
+    conn->flush ();
+    
+    bufferevent_unlock (conn->bev);
+  }
+  
+  
+  
+  void
+  connection::on_output_drained (struct evbuffer *buf,
+    const struct evbuffer_cb_info *info, void *ctx)
+  {
+    if (info->n_deleted == 0)
+      return;
+    
+    // data has been written to the socket
+    connection *conn = static_cast<connection *> (ctx);
+    conn->qbytes -= (long long)info->n_deleted;
+    conn->srv.account_queued (- (long long)info->n_deleted);
+  }
+  
+  
+  
+// number of bytes a lane with a weight of 1 may send per round.
+#define DRR_QUANTUM     1500
+  
+  /* 
+   * Removes and returns the next packet to be written out, according to
+   * the server's scheduling mode, or null if there is none.
+   */
+  connection::packet_container*
+  connection::next_container ()
+  {
+    // packets queued after a barrier are held back until the barrier has
+    // been sent, and the barrier itself waits for everything queued before it.
+    int barrier = this->barriers.empty () ? 0 : this->barriers.front ();
+    int min_id = 0;
+    for (auto& lane : this->lanes)
+      if (!lane.empty () && (min_id == 0 || lane.front ()->id < min_id))
+        min_id = lane.front ()->id;
+    if (min_id == 0)
+      return nullptr;
+    
+    auto eligible = [this, barrier, min_id] (int i) -> bool {
+      if (this->lanes[i].empty ())
+        return false;
+      int id = this->lanes[i].front ()->id;
+      return !barrier || id < barrier || (id == barrier && min_id == barrier);
+    };
+    
+    auto pop = [this, barrier] (int i) -> packet_container* {
+      packet_container *cont = this->lanes[i].front ();
+      this->lanes[i].pop_front ();
+      if (cont->id == barrier)
+        this->barriers.pop_front ();
+      return cont;
+    };
+    
+    auto& cfg = this->srv.get_config ();
+    if (cfg.send_mode == SSM_STRICT)
       {
-        // initiate write
-        auto cont = conn->init_pack;
-        bufferevent_write (conn->bev,
-          cont->pack->get_data (), cont->pack->get_length ());
-        conn->init_pack = nullptr;
+        for (int i = 0; i < PP_COUNT; ++i)
+          if (eligible (i))
+            return pop (i);
+        return nullptr;
       }
     
-    bufferevent_unlock (conn->bev);
+    // deficit round-robin: every lane receives a quantum proportional to its
+    // weight each round, and sends packets for as long as it has credit.
+    bool any = false;
+    for (int i = 0; i < PP_COUNT; ++i)
+      if (eligible (i))
+        { any = true; break; }
+    if (!any)
+      return nullptr;
     
-    if (conn->proto->get_handler ())
-      conn->proto->get_handler ()->tick ();
+    for (;;)
+      {
+        int i = this->drr_lane;
+        if (eligible (i))
+          {
+            packet_container *cont = this->lanes[i].front ();
+            if (this->drr_deficit[i] >= cont->len)
+              {
+                this->drr_deficit[i] -= cont->len;
+                pop (i);
+                if (this->lanes[i].empty ())
+                  this->drr_deficit[i] = 0;
+                return cont;
+              }
+          }
+        
+        this->drr_lane = (i + 1) % PP_COUNT;
+        if (eligible (this->drr_lane))
+          this->drr_deficit[this->drr_lane] +=
+            DRR_QUANTUM * cfg.send_weights[this->drr_lane];
+      }
+  }
+  
+  /* 
+   * Moves queued packets into the bufferevent's output buffer, until the
+   * server's send window is filled.
+   * Must be called from the connection's event loop.
+   */
+  void
+  connection::flush ()
+  {
+    this->flush_pending = false;
     
-    if (!evtimer_pending (conn->tev, NULL))
+    // keeping the output buffer small leaves room for the scheduler to put
+    // high priority packets ahead of bulk data that is still queued.
+    struct evbuffer *output = bufferevent_get_output (this->bev);
+    int window = this->srv.get_config ().send_window;
+    while (window <= 0 || (int)evbuffer_get_length (output) < window)
       {
-        struct timeval tv = { 0, 20000 };
-        event_del (conn->tev);
-        evtimer_add (conn->tev, &tv );
+        packet_container *cont = this->next_container ();
+        if (!cont)
+          break;
+        
+        this->set_cork (true);
+        
+        // stateful transformations (encryption) are applied here, in the
+        // order the packets are actually written out.
+        if (!this->apply_out_transformations (cont->buf, cont->stage, -1,
+          cont->tmask))
+          {
+            log (LT_ERROR) << "Could not apply transformation to packet, disconnecting player." << std::endl;
+            evbuffer_free (cont->buf);
+            delete cont;
+            this->disconnect ();
+            return;
+          }
+        
+        int len = (int)evbuffer_get_length (cont->buf);
+        if (len != cont->len)
+          {
+            this->qbytes += len - cont->len;
+            this->srv.account_queued (len - cont->len);
+            cont->len = len;
+          }
+        
+        evbuffer_add_buffer (output, cont->buf);
+        this->w->stats.bytes += cont->len;
+        if (cont->flags & CONN_SEND_DISCONNECT)
+          this->drain_dc = true;
+        
+        evbuffer_free (cont->buf);
+        delete cont;
       }
   }
   
+  /* 
+   * Turns TCP_CORK on or off for the connection's socket, if enabled in
+   * the server's configuration.
+   */
+  void
+  connection::set_cork (bool on)
+  {
+#ifdef TCP_CORK
+    if (on == this->corked || !this->srv.get_config ().tcp_cork)
+      return;
+    
+    int val = on ? 1 : 0;
+    setsockopt (this->sock, IPPROTO_TCP, TCP_CORK, &val, sizeof val);
+    this->corked = on;
+#endif
+  }
+  
   
   
 //------------------------------------------------------------------------------
@@ -455,24 +935,207 @@ namespace hc {
   connection::send (packet *pack, unsigned int flags)
   {
     std::lock_guard<std::recursive_mutex> dc_guard { this->dc_mtx };
-    if (!this->can_send || this->disconnected || this->disconnect_req)
+    if (!this->can_send || this->disconnected || this->disconnect_req
+      || !this->check_budget (flags))
       { delete pack; return; }
     
-    int pack_id = this->next_packet_id++;
+    // the packet's contents are referenced, not copied; the packet gets
+    // destroyed once the data is written out or transformed.
+    packet_priority prio = pack->get_priority ();
+    struct evbuffer *buf = evbuffer_new ();
+    evbuffer_add_reference (buf, pack->get_data (), pack->get_length (),
+      [] (const void *data, size_t len, void *extra) {
+        delete static_cast<packet *> (extra);
+      }, pack);
     
-    // apply transformation first
-    this->apply_out_transformations (pack);
+    // apply stateless transformations first, the rest is done once the
+    // packet is taken out of its lane.
+    unsigned long long sig;
+    int split = this->stateless_prefix (&sig);
+    if (!this->apply_out_transformations (buf, 0, split))
+      {
+        log (LT_ERROR) << "Could not apply transformation to packet, disconnecting player." << std::endl;
+        evbuffer_free (buf);
+        this->disconnect ();
+        return;
+      }
+    
+    this->enqueue (buf, prio, flags, split);
+  }
+  
+  /* 
+   * Queues the specified shared packet to be sent.
+   * The connection holds a reference to the packet until it is written;
+   * the caller's reference is left untouched.
+   */
+  void
+  connection::send (shared_packet *sp, unsigned int flags)
+  {
+    std::lock_guard<std::recursive_mutex> dc_guard { this->dc_mtx };
+    if (!this->can_send || this->disconnected || this->disconnect_req
+      || !this->check_budget (flags))
+      return;
+    
+    // stateless transformations are applied once per packet and shared with
+    // every other connection that uses the same settings.
+    unsigned long long sig;
+    int split = this->stateless_prefix (&sig);
+    
+    const unsigned char *data = sp->get_packet ()->get_data ();
+    int len = (int)sp->get_packet ()->get_length ();
+    if (sig != 0)
+      {
+        auto f = sp->get_frame (sig,
+          [this, data, len, split] (unsigned char **out, int *out_len) -> bool {
+            struct evbuffer *tmp = evbuffer_new ();
+            evbuffer_add_reference (tmp, data, len, NULL, NULL);
+            if (!this->apply_out_transformations (tmp, 0, split))
+              {
+                evbuffer_free (tmp);
+                return false;
+              }
+            
+            *out_len = (int)evbuffer_get_length (tmp);
+            *out = new unsigned char [*out_len];
+            evbuffer_remove (tmp, *out, *out_len);
+            evbuffer_free (tmp);
+            return true;
+          });
+        if (!f)
+          {
+            log (LT_ERROR) << "Could not apply transformation to packet, disconnecting player." << std::endl;
+            this->disconnect ();
+            return;
+          }
+        
+        data = f->data;
+        len = f->len;
+      }
+    
+    struct evbuffer *buf = evbuffer_new ();
+    evbuffer_add_reference (buf, data, len,
+      [] (const void *data, size_t len, void *extra) {
+        static_cast<shared_packet *> (extra)->release ();
+      }, sp->grab ());
+    
+    this->enqueue (buf, sp->get_packet ()->get_priority (), flags, split);
+  }
+  
+  /* 
+   * Applies the server's send budget policy to a packet that is about to
+   * be sent with the specified flags.
+   * Returns false if the packet should be discarded.
+   */
+  bool
+  connection::check_budget (unsigned int flags)
+  {
+    auto& cfg = this->srv.get_config ();
+    if (!this->is_congested ())
+      {
+        this->over_budget = false;
+        return true;
+      }
+    
+    auto now = std::chrono::steady_clock::now ();
+    if (!this->over_budget)
+      {
+        this->over_budget = true;
+        this->over_since = now;
+      }
+    
+    switch (cfg.send_policy)
+      {
+      case SBP_DROP:
+        return !(flags & CONN_SEND_DROPPABLE);
+      
+      case SBP_DISCONNECT:
+        if (now - this->over_since > std::chrono::milliseconds (cfg.send_grace))
+          {
+            log (LT_WARNING) << "@" << this->ip << " is not keeping up with sent data ("
+              << this->qbytes << " bytes queued), disconnecting" << std::endl;
+            this->disconnect ();
+            return false;
+          }
+        return true;
+      
+      case SBP_DEFER:
+      default:
+        return true;
+      }
+  }
+  
+  /* 
+   * Queues the packet data in the specified buffer, that has been
+   * transformed by the out transformers before `stage', in the appropriate
+   * priority lane.
+   */
+  void
+  connection::enqueue (struct evbuffer *buf, packet_priority prio,
+    unsigned int flags, int stage)
+  {
+    if (this->detached)
+      {
+        // there is nowhere to write the packet to, so it is finished and
+        // counted right away.
+        if (this->apply_out_transformations (buf, stage))
+          this->sunk_bytes += (long long)evbuffer_get_length (buf);
+        evbuffer_free (buf);
+        
+        if (flags & CONN_SEND_DISCONNECT)
+          this->disconnect ();
+        return;
+      }
+    
+    int lane = (int)((flags >> 8) & 0x7) - 1;
+    if (lane < 0 || lane >= PP_COUNT)
+      lane = prio;
     
     packet_container *cont = new packet_container;
-    cont->pack = pack;
+    cont->buf = buf;
+    cont->len = (int)evbuffer_get_length (buf);
     cont->flags = flags;
-    cont->id = pack_id;
+    cont->id = this->next_packet_id++;
+    cont->stage = stage;
     if (flags & CONN_SEND_DISCONNECT)
       this->can_send = false;
     
-    this->outq.push_back (cont);
-    if (this->outq.size () == 1)
-      this->init_pack = cont;
+    // remember which of the remaining transformers were active at this point
+    // (e.g. encryption might be turned on before the packet is flushed).
+    auto& trs = this->proto->get_transformers ();
+    unsigned int tmask = 0;
+    for (int i = 0; i < (int)trs.size (); ++i)
+      if (trs[i]->is_on ())
+        tmask |= 1u << i;
+    cont->tmask = tmask & ~((1u << stage) - 1);
+    
+    // packets must not overtake each other across a change in framing.
+    if ((flags & (CONN_SEND_BARRIER | CONN_SEND_DISCONNECT))
+      || tmask != this->last_tmask)
+      this->barriers.push_back (cont->id);
+    this->last_tmask = tmask;
+    
+    this->qbytes += cont->len;
+    this->srv.account_queued (cont->len);
+    
+    this->lanes[lane].push_back (cont);
+    if (!this->flush_pending)
+      {
+        this->flush_pending = true;
+        
+        int window = this->srv.get_config ().flush_window;
+        if (window <= 0)
+          this->notify ();
+        else if (this->nev)
+          {
+            // align the flush to the next multiple of the window, so that
+            // everything sent during a server tick goes out together.
+            auto now = std::chrono::duration_cast<std::chrono::milliseconds> (
+              std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+            int delay = window - (int)(now % window);
+            struct timeval tv = { delay / 1000, (delay % 1000) * 1000 };
+            event_add (this->nev, &tv);
+          }
+      }
   }
 }
 
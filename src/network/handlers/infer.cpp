@@ -41,11 +41,17 @@ namespace hc {
   
   /* 
    * Switches the protocol implementation used by the underlying connection.
+   * If `status' is true, a lightweight implementation that can only answer
+   * server list pings is used instead.
    */
   void
-  infer_packet_handler::success (const char *name, packet_reader& reader)
+  infer_packet_handler::success (const char *name, packet_reader& reader,
+    bool status)
   {
-    protocol *proto = protocol::create (name);
+    protocol *proto = status ? protocol::create_status (name)
+                             : protocol::create (name);
+    
+    // NOTE: this destroys the handler.
     this->conn->set_protocol (proto);
     
     // re-process first packet by the new protocol implementation
@@ -68,10 +74,20 @@ namespace hc {
     
     // protocol version
     int pv = reader.read_byte ();
+    
+    // skip server address and port, and check whether the client is only
+    // interested in the server's status.
+    char addr[256];
+    if (!reader.read_string (addr, sizeof addr)
+      || reader.get_pos () + 3 > reader.length ())
+      { this->fail (); return; }
+    reader.read_short ();
+    bool status = (reader.read_varint () == 1);
+    
     switch (pv)
       {
       case 47:
-        this->success ("1.8", reader);
+        this->success ("1.8", reader, status);
         return;
       
       default:
@@ -17,6 +17,8 @@
  */
 
 #include "network/handlers/mc18.hpp"
+#include "network/handlers/mc18_status.hpp"
+#include "network/shared_packet.hpp"
 #include "network/packet.hpp"
 #include "network/connection.hpp"
 #include "system/server.hpp"
@@ -76,6 +78,7 @@ namespace hc {
     
     this->conn->set_player (pl);
     this->pl = pl;
+    this->conn->clear_deadline (CONN_DEADLINE_LOGIN);
     log (LT_SYSTEM) << "Player `" << pl->get_username () << "' logging in from @"
       << this->conn->get_ip () << " (UUID: " << pl->get_uuid ().str () << ")" << std::endl;
     
@@ -90,7 +93,8 @@ namespace hc {
     // ---
     
     // begin compression
-    this->conn->send (this->builder->make_set_compression (srv.get_config ().compress_threshold));
+    this->conn->send (this->builder->make_set_compression (srv.get_config ().compress_threshold),
+      CONN_SEND_BARRIER);
     for (auto trans : this->conn->get_protocol ()->get_transformers ())
       {
         zlib_mc18_transformer *tr =
@@ -214,32 +218,15 @@ namespace hc {
     // 
     
     server& srv = this->conn->get_server ();
-    
-    std::unique_ptr<json::j_object> js { new json::j_object () };
-    {
-      using namespace json;
-      
-      j_object *obj = new j_object ();
-      obj->set ("name", new j_string ("1.8"));
-      obj->set ("protocol", new j_number (47));
-      js->set ("version", obj);
-      
-      obj = new j_object ();
-      obj->set ("max", new j_number (srv.get_config ().max_players));
-      obj->set ("online", new j_number (srv.get_player_count ()));
-      obj->set ("sample", new j_array ());
-      js->set ("players", obj);
-      
-      obj = new j_object ();
-      obj->set ("text", new j_string (srv.get_config ().motd));
-      js->set ("description", obj);
-    }
-    
-    std::ostringstream ss;
-    json_writer writer (ss);
-    writer.write (js.get ());
-    
-    this->conn->send (this->builder->make_status_response (ss.str ()));
+    auto builder = this->builder;
+    
+    shared_packet *sp = srv.get_status_packet (
+      this->conn->get_protocol ()->get_name (),
+      [&srv, builder] () -> packet* {
+        return mc18_status_handler::make_response (srv, builder);
+      });
+    this->conn->send (sp);
+    sp->release ();
   }
   
   void
@@ -571,6 +558,20 @@ namespace hc {
     log (LT_DEBUG) << "switching to slot [" << this->pl->cur_slot << "]" << std::endl;
   }
   
+  void
+  mc18_packet_handler::handle_p0b (packet_reader& reader)
+  {
+    // 
+    // 0x0B: Entity Action
+    //
+    
+    reader.read_varint (); // entity ID (always the player's own)
+    int action = reader.read_varint ();
+    reader.read_varint (); // horse jump boost
+    
+    this->pl->on_action ((entity_action)action);
+  }
+  
   void
   mc18_packet_handler::handle_p0d (packet_reader& reader)
   {
@@ -716,7 +717,7 @@ namespace hc {
       &mc18_packet_handler::handle_p04, &mc18_packet_handler::handle_p05,
       &mc18_packet_handler::handle_p06, &mc18_packet_handler::handle_p07,
       &mc18_packet_handler::handle_p08, &mc18_packet_handler::handle_p09,
-      &mc18_packet_handler::handle_xx, &mc18_packet_handler::handle_xx,
+      &mc18_packet_handler::handle_xx, &mc18_packet_handler::handle_p0b,
       &mc18_packet_handler::handle_xx, &mc18_packet_handler::handle_p0d,
       &mc18_packet_handler::handle_p0e, &mc18_packet_handler::handle_xx,
       &mc18_packet_handler::handle_p10, &mc18_packet_handler::handle_xx,
@@ -756,6 +757,40 @@ namespace hc {
   
   
   
+  /* 
+   * Returns true for play state packets that are cheap enough to be
+   * handled on the connection's I/O thread.
+   */
+  bool
+  mc18_packet_handler::is_inline_safe (packet_reader& reader)
+  {
+    if (this->state != PS_PLAY)
+      return false;
+    
+    // keep-alives, player on-ground/look updates and held item changes only
+    // modify the player's own state.  anything that might stream chunks or
+    // modify the world goes through the thread pool.
+    static const bool _play_inline[] = {
+      true,  false, false, true,  // 0x00 - 0x03
+      false, true,  false, false, // 0x04 - 0x07
+      false, true,  false, false, // 0x08 - 0x0B
+      false, false, false, false, // 0x0C - 0x0F
+      false, false, false, false, // 0x10 - 0x13
+      false, false, false, false, // 0x14 - 0x17
+      false, false,               // 0x18 - 0x19
+    };
+    
+    reader.rewind ();
+    reader.read_varint (); // length
+    int opc = reader.read_varint ();
+    reader.rewind ();
+    
+    return opc >= 0 && opc < (int)(sizeof _play_inline / sizeof (bool))
+      && _play_inline[opc];
+  }
+  
+  
+  
   void
   mc18_packet_handler::set_connection (connection *conn)
   {
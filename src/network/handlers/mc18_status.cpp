@@ -0,0 +1,126 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "network/handlers/mc18_status.hpp"
+#include "network/packet.hpp"
+#include "network/shared_packet.hpp"
+#include "network/connection.hpp"
+#include "network/protocol.hpp"
+#include "network/builders/mc18.hpp"
+#include "system/server.hpp"
+#include "util/json.hpp"
+#include <sstream>
+#include <memory>
+
+
+namespace hc {
+  
+  mc18_status_handler::mc18_status_handler ()
+  {
+    this->handshaken = false;
+  }
+  
+  
+  
+  /* 
+   * Builds the status response sent to server list pings.
+   */
+  packet*
+  mc18_status_handler::make_response (server& srv, mc18_packet_builder *builder)
+  {
+    std::unique_ptr<json::j_object> js { new json::j_object () };
+    {
+      using namespace json;
+      
+      j_object *obj = new j_object ();
+      obj->set ("name", new j_string ("1.8"));
+      obj->set ("protocol", new j_number (47));
+      js->set ("version", obj);
+      
+      obj = new j_object ();
+      obj->set ("max", new j_number (srv.get_config ().max_players));
+      obj->set ("online", new j_number (srv.get_player_count ()));
+      obj->set ("sample", new j_array ());
+      js->set ("players", obj);
+      
+      obj = new j_object ();
+      obj->set ("text", new j_string (srv.get_config ().motd));
+      js->set ("description", obj);
+    }
+    
+    std::ostringstream ss;
+    json_writer writer (ss);
+    writer.write (js.get ());
+    
+    return builder->make_status_response (ss.str ());
+  }
+  
+  
+  
+  void
+  mc18_status_handler::handle (packet_reader& reader)
+  {
+    if (!this->conn)
+      return;
+    
+    reader.read_varint (); // length
+    int opc = reader.read_varint ();
+    
+    if (!this->handshaken)
+      {
+        // the handshake has already been inspected by the inference handler.
+        if (opc != 0x00)
+          { this->conn->disconnect (); return; }
+        this->handshaken = true;
+        return;
+      }
+    
+    server& srv = this->conn->get_server ();
+    auto builder = static_cast<mc18_packet_builder *> (
+      this->conn->get_protocol ()->get_builder ());
+    switch (opc)
+      {
+      // 0x00: Status Request
+      case 0x00:
+        {
+          shared_packet *sp = srv.get_status_packet (
+            this->conn->get_protocol ()->get_name (),
+            [&srv, builder] () -> packet* {
+              return mc18_status_handler::make_response (srv, builder);
+            });
+          this->conn->send (sp);
+          sp->release ();
+        }
+        break;
+      
+      // 0x01: Status Ping
+      case 0x01:
+        {
+          unsigned long long time = reader.read_long ();
+          this->conn->send (builder->make_status_ping (time),
+            CONN_SEND_DISCONNECT);
+        }
+        break;
+      
+      default:
+        this->conn->disconnect ();
+        break;
+      }
+  }
+}
+
@@ -27,6 +27,14 @@
 
 namespace hc {
   
+  packet_reader::packet_reader ()
+  {
+    this->arr = nullptr;
+    this->len = 0;
+    this->pos = 0;
+    this->copy = false;
+  }
+  
   packet_reader::packet_reader (const unsigned char *arr, unsigned int len, bool copy)
   {
     this->len = len;
@@ -50,6 +58,24 @@ namespace hc {
   
   
   
+  /* 
+   * Makes the reader wrap around the specified byte array instead (without
+   * copying it), and rewinds it.
+   */
+  void
+  packet_reader::reset (const unsigned char *arr, unsigned int len)
+  {
+    if (this->copy)
+      delete[] this->arr;
+    
+    this->arr = const_cast<unsigned char *> (arr);
+    this->len = len;
+    this->pos = 0;
+    this->copy = false;
+  }
+  
+  
+  
 //------------------------------------------------------------------------------
   
   bool
@@ -150,6 +176,7 @@ namespace hc {
     
     this->rbeg = reserve_beg;
     this->arr += this->rbeg;
+    this->prio = PP_MOVEMENT;
   }
   
   packet::~packet ()
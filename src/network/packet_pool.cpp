@@ -0,0 +1,106 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "network/packet_pool.hpp"
+
+
+namespace hc {
+  
+  packet_pool::packet_pool ()
+  {
+    for (int i = 0; i < CLASS_COUNT; ++i)
+      {
+        this->free_lists[i] = nullptr;
+        this->free_counts[i] = 0;
+      }
+  }
+  
+  packet_pool::~packet_pool ()
+  {
+    for (int i = 0; i < CLASS_COUNT; ++i)
+      {
+        packet_block *block = this->free_lists[i];
+        while (block)
+          {
+            packet_block *next = block->next;
+            delete[] block->data;
+            delete block;
+            block = next;
+          }
+      }
+  }
+  
+  
+  
+  /* 
+   * Returns a block that can hold at least the specified amount of bytes,
+   * or null if the size exceeds the largest size class.
+   */
+  packet_block*
+  packet_pool::acquire (unsigned int size)
+  {
+    int cls = 0;
+    unsigned int cap = MIN_BLOCK_SIZE;
+    while (cap < size)
+      {
+        if (++ cls == CLASS_COUNT)
+          return nullptr;
+        cap <<= 1;
+      }
+    
+    {
+      std::lock_guard<std::mutex> guard { this->mtx };
+      packet_block *block = this->free_lists[cls];
+      if (block)
+        {
+          this->free_lists[cls] = block->next;
+          -- this->free_counts[cls];
+          return block;
+        }
+    }
+    
+    packet_block *block = new packet_block ();
+    block->data = new unsigned char [cap];
+    block->cap = cap;
+    block->cls = cls;
+    block->next = nullptr;
+    return block;
+  }
+  
+  /* 
+   * Returns the specified block back to the pool.
+   */
+  void
+  packet_pool::release (packet_block *block)
+  {
+    {
+      std::lock_guard<std::mutex> guard { this->mtx };
+      if (this->free_counts[block->cls] < MAX_FREE_BLOCKS)
+        {
+          block->next = this->free_lists[block->cls];
+          this->free_lists[block->cls] = block;
+          ++ this->free_counts[block->cls];
+          return;
+        }
+    }
+    
+    delete[] block->data;
+    delete block;
+  }
+}
+
@@ -23,6 +23,7 @@
 #include <unordered_map>
 
 #include "network/handlers/mc18.hpp"
+#include "network/handlers/mc18_status.hpp"
 #include "network/builders/mc18.hpp"
 #include "network/transformers/aes.hpp"
 #include "network/transformers/zlib_mc18.hpp"
@@ -79,6 +80,16 @@ namespace hc {
   }
   
   
+  static protocol*
+  _create_mc18_status ()
+  {
+    // no transformers: status queries are never compressed or encrypted.
+    return new protocol ("1.8",
+      new mc17_packet_delimiter (), new mc18_status_handler (),
+      new mc18_packet_builder ());
+  }
+  
+  
   /* 
    * Creates the protocol that matches the specified client version.
    * Returns null if no matching protocol implementation is found.
@@ -99,5 +110,26 @@ namespace hc {
       return nullptr;
     return itr->second ();
   }
+  
+  /* 
+   * Creates a lightweight implementation of the specified client version
+   * that can only answer server list pings.
+   * Returns null if no matching protocol implementation is found.
+   */
+  protocol*
+  protocol::create_status (const char *version)
+  {
+    const std::unordered_map<std::string, protocol* (*) ()> _map {
+      { "1.8.3", &_create_mc18_status },
+      { "1.8.2", &_create_mc18_status },
+      { "1.8.1", &_create_mc18_status },
+      { "1.8", &_create_mc18_status },
+    };
+    
+    auto itr = _map.find (version);
+    if (itr == _map.end ())
+      return nullptr;
+    return itr->second ();
+  }
 }
 
@@ -0,0 +1,136 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "network/shared_packet.hpp"
+#include "network/packet.hpp"
+#include "network/connection.hpp"
+#include "network/protocol.hpp"
+
+
+namespace hc {
+  
+  shared_packet::shared_packet (packet *pack)
+  {
+    this->pack = pack;
+    this->refc = 1;
+  }
+  
+  shared_packet::~shared_packet ()
+  {
+    for (auto& f : this->frames)
+      delete[] f.data;
+    delete this->pack;
+  }
+  
+  
+  
+  /* 
+   * Wraps the specified packet in a new shared packet whose reference
+   * count is one.
+   * NOTE: Ownership of the packet is passed to the shared packet.
+   */
+  shared_packet*
+  shared_packet::create (packet *pack)
+  {
+    return new shared_packet (pack);
+  }
+  
+  /* 
+   * Decrements the packet's reference count, and destroys it once it
+   * drops to zero.
+   */
+  void
+  shared_packet::release ()
+  {
+    if (-- this->refc == 0)
+      delete this;
+  }
+  
+  
+  
+  /* 
+   * Returns the contents of the packet as transformed by the stateless
+   * transformers described by the specified signature.  If no such frame
+   * has been produced yet, the given function is called to produce it.
+   * Returns null if the frame could not be produced.
+   */
+  const shared_packet::frame*
+  shared_packet::get_frame (unsigned long long sig,
+    std::function<bool (unsigned char **data, int *len)>&& produce)
+  {
+    std::lock_guard<std::mutex> guard { this->frame_mtx };
+    for (auto& f : this->frames)
+      if (f.sig == sig)
+        return &f;
+    
+    frame f;
+    f.sig = sig;
+    if (!produce (&f.data, &f.len))
+      return nullptr;
+    
+    this->frames.push_back (f);
+    return &this->frames.back ();
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  protocol_packet::protocol_packet (
+    std::function<packet* (packet_builder *)>&& build)
+    : build (std::move (build))
+    { }
+  
+  protocol_packet::~protocol_packet ()
+  {
+    for (auto& p : this->packs)
+      p.second->release ();
+  }
+  
+  
+  
+  /* 
+   * Returns the packet as built for the specified connection's protocol.
+   * The returned packet is owned by this object; grab it to keep it
+   * around for longer.
+   */
+  shared_packet*
+  protocol_packet::get (connection& conn)
+  {
+    protocol *proto = conn.get_protocol ();
+    for (auto& p : this->packs)
+      if (p.first == proto->get_name ())
+        return p.second;
+    
+    shared_packet *sp = shared_packet::create (
+      this->build (proto->get_builder ()));
+    this->packs.emplace_back (proto->get_name (), sp);
+    return sp;
+  }
+  
+  /* 
+   * Sends the packet, as built for the connection's protocol, to the
+   * specified connection.
+   */
+  void
+  protocol_packet::send_to (connection& conn)
+  {
+    conn.send (this->get (conn));
+  }
+}
+
@@ -17,9 +17,8 @@
  */
 
 #include "network/transformers/aes.hpp"
-#include <cryptopp/files.h>
-#include <cstring>
-#include <string>
+#include <cryptopp/cpu.h>
+#include <event2/buffer.h>
 
 
 namespace hc {
@@ -57,80 +56,81 @@ namespace hc {
   
   
   
+  /* 
+   * Returns true if the processor supports AES-NI instructions, which
+   * Crypto++ uses automatically when available.
+   */
   bool
-  aes_transformer::transform_in (const unsigned char *data,
-    unsigned int len, unsigned char **outp, int *out_len, int *consumed)
+  aes_transformer::hardware_accelerated ()
   {
-    unsigned char *out = new unsigned char[len];
-    *outp = out;
-    
-    std::string in_str ((char *)data, len);
-    std::string out_str;
-    
+#if CRYPTOPP_BOOL_X86 || CRYPTOPP_BOOL_X64
+    return CryptoPP::HasAESNI ();
+#else
+    return false;
+#endif
+  }
+  
+  
+  
+  bool
+  aes_transformer::transform_in (struct evbuffer *in, struct evbuffer *out)
+  {
+    // received data sits in chains that we own, so it is decrypted in place
+    // and the chains are then moved over to the next buffer as they are.
     try
       {
-        CryptoPP::StringSource (in_str, true,
-          new CryptoPP::StreamTransformationFilter (*this->decryptor,
-            new CryptoPP::StringSink (out_str)));
+        while (evbuffer_get_length (in) > 0)
+          {
+            struct evbuffer_iovec iv;
+            evbuffer_peek (in, -1, NULL, &iv, 1);
+            
+            unsigned char *data = static_cast<unsigned char *> (iv.iov_base);
+            this->decryptor->ProcessData (data, data, iv.iov_len);
+            evbuffer_remove_buffer (in, out, iv.iov_len);
+          }
       }
     catch (const CryptoPP::Exception&)
       {
-        delete[] out;
         return false;
       }
     
-    std::memcpy (out, out_str.c_str (), out_str.size ());
-    *out_len = (int)out_str.size ();
-    *consumed = len;
-    
     return true;
   }
   
   bool
-  aes_transformer::transform_out (const unsigned char *data,
-    unsigned int len, unsigned char **outp, int *out_len)
+  aes_transformer::transform_out (struct evbuffer *in, struct evbuffer *out)
   {
-    unsigned char *out = new unsigned char[len];
-    *outp = out;
+    // outgoing data may be referenced from packets that are still in use
+    // elsewhere, so it is encrypted straight into reserved space in the
+    // output buffer instead.
+    int len = (int)evbuffer_get_length (in);
+    if (len == 0)
+      return true;
     
-    std::string in_str ((char *)data, len);
-    std::string out_str;
+    struct evbuffer_iovec v;
+    if (evbuffer_reserve_space (out, len, &v, 1) != 1)
+      return false;
     
+    unsigned char *dest = static_cast<unsigned char *> (v.iov_base);
     try
       {
-        CryptoPP::StringSource (in_str, true,
-          new CryptoPP::StreamTransformationFilter (*this->encryptor,
-            new CryptoPP::StringSink (out_str)));
+        while (evbuffer_get_length (in) > 0)
+          {
+            struct evbuffer_iovec iv;
+            evbuffer_peek (in, -1, NULL, &iv, 1);
+            this->encryptor->ProcessData (dest,
+              static_cast<const unsigned char *> (iv.iov_base), iv.iov_len);
+            dest += iv.iov_len;
+            evbuffer_drain (in, iv.iov_len);
+          }
       }
     catch (const CryptoPP::Exception&)
       {
-        delete[] out;
         return false;
       }
     
-    std::memcpy (out, out_str.c_str (), out_str.size ());
-    *out_len = (int)out_str.size ();
-    
-    return true;
-  }
-  
-  int
-  aes_transformer::estimate_in (unsigned int len)
-  {
-    return len;
-  }
-  
-  int
-  aes_transformer::estimate_out (unsigned int len)
-  {
-    return len;
-  }
-  
-  int
-  aes_transformer::in_enough (const unsigned char *data,
-    unsigned int len)
-  {
-    return 1;
+    v.iov_len = len;
+    return (evbuffer_commit_space (out, &v, 1) == 0);
   }
 }
 
@@ -18,6 +18,7 @@
 
 #include "network/transformers/zlib_mc18.hpp"
 #include "util/binary.hpp"
+#include <event2/buffer.h>
 #include <cstring>
 
 
@@ -26,6 +27,7 @@ namespace hc {
   zlib_mc18_transformer::zlib_mc18_transformer ()
   {
     this->threshold = 256;
+    this->level = Z_DEFAULT_COMPRESSION;
   }
   
   zlib_mc18_transformer::~zlib_mc18_transformer ()
@@ -35,220 +37,152 @@ namespace hc {
   
   
   
+#define ZLIB_MAX_DATA_LENGTH  2097151 // largest length a client may send
+  
   bool
-  zlib_mc18_transformer::transform_in (const unsigned char *data, 
-    unsigned int len, unsigned char **outp, int *out_len, int *consumed)
+  zlib_mc18_transformer::transform_in (struct evbuffer *in,
+    struct evbuffer *out)
   {
-    int outc = len * 4;
-    int outl = 0;
-    unsigned char *out = new unsigned char [outc];
-    
     // process as many packets as possible
-    const unsigned char *ptr = data;
-    *consumed = 0;
     for (;;)
       {
+        unsigned char hdr[10];
+        int hdr_len = (int)evbuffer_copyout (in, hdr, sizeof hdr);
+        if (hdr_len <= 0)
+          return true;
+        
+        switch (bin::got_varint (hdr, hdr_len))
+          {
+          case 0: return true; // need more data
+          case -1: return false;
+          }
+        
         int plen_len, dlen_len;
-        int plen = bin::read_varint (ptr, &plen_len);
-        int dlen = bin::read_varint (ptr + plen_len, &dlen_len);
+        int plen = bin::read_varint (hdr, &plen_len);
+        if (plen <= 0 || plen > ZLIB_MAX_DATA_LENGTH)
+          return false;
+        if ((int)evbuffer_get_length (in) < plen_len + plen)
+          return true; // need more data
+        
+        if (bin::got_varint (hdr + plen_len, hdr_len - plen_len) != 1)
+          return false;
+        int dlen = bin::read_varint (hdr + plen_len, &dlen_len);
+        if (dlen < 0 || dlen > ZLIB_MAX_DATA_LENGTH || dlen_len > plen)
+          return false;
+        
+        int clen = plen - dlen_len;
+        evbuffer_drain (in, plen_len + dlen_len);
         
         if (dlen == 0)
           {
-            // uncompressed packet
-            
-            int size = plen - dlen_len + 5;
-            if (outl + size >= outc)
-              {
-                unsigned char *nout = new unsigned char [outc * 2];
-                std::memcpy (nout, out, outc);
-                
-                delete[] out;
-                out = nout;
-                outc *= 2;
-              }
-            
-            outl += bin::write_varint (out + outl, plen - dlen_len);
-            
-            std::memcpy (out + outl, ptr + plen_len + dlen_len, plen - dlen_len);
-            outl += plen - dlen_len;
+            // uncompressed packet, move the body over as it is
+            hdr_len = bin::write_varint (hdr, clen);
+            evbuffer_add (out, hdr, hdr_len);
+            evbuffer_remove_buffer (in, out, clen);
+            continue;
           }
-        else
+        
+        // inflate the packet's chains straight into reserved output space
+        hdr_len = bin::write_varint (hdr, dlen);
+        struct evbuffer_iovec v;
+        if (evbuffer_reserve_space (out, hdr_len + dlen, &v, 1) != 1)
+          return false;
+        std::memcpy (v.iov_base, hdr, hdr_len);
+        
+        inflateReset (&this->strm_in);
+        this->strm_in.next_out = static_cast<Bytef *> (v.iov_base) + hdr_len;
+        this->strm_in.avail_out = dlen;
+        
+        int ret = Z_OK;
+        while (clen > 0 && ret == Z_OK)
           {
-            this->strm_in.next_in = (Bytef *) (ptr + plen_len + dlen_len);
-            this->strm_in.avail_in = plen - dlen_len;
-            inflateReset (&this->strm_in);
+            struct evbuffer_iovec iv;
+            evbuffer_peek (in, -1, NULL, &iv, 1);
+            int n = ((int)iv.iov_len < clen) ? (int)iv.iov_len : clen;
             
-            // put data length
-            {
-              if (outl + 5 >= outc)
-                {
-                  unsigned char *nout = new unsigned char [outc * 2];
-                  std::memcpy (nout, out, outc);
-                  
-                  delete[] out;
-                  out = nout;
-                  outc *= 2;
-                }
-              
-              outl += bin::write_varint (out + outl, dlen);
-            }
+            this->strm_in.next_in = static_cast<Bytef *> (iv.iov_base);
+            this->strm_in.avail_in = n;
+            ret = inflate (&this->strm_in, Z_NO_FLUSH);
             
-            for (;;)
-              {
-                this->strm_in.next_out = out + outl;
-                this->strm_in.avail_out = outc - outl;
-                
-                auto prev_avail = this->strm_in.avail_out;
-                auto ret = inflate (&this->strm_in, Z_NO_FLUSH);
-                outl += prev_avail - this->strm_in.avail_out;
-                switch (ret)
-                  {
-                  case Z_STREAM_END:
-                    goto inflate_done;
-                  
-                  case Z_OK:
-                    break;
-                  
-                  default:
-                    delete[] out;
-                    return false;
-                  }
-                
-                if (this->strm_in.avail_out == 0)
-                  {
-                    // increase buffer size
-                    
-                    unsigned char *nout = new unsigned char [outc * 2];
-                    std::memcpy (nout, out, outc);
-                    
-                    delete[] out;
-                    out = nout;
-                    outc *= 2;
-                  }
-              }
-          inflate_done: ;
+            evbuffer_drain (in, n);
+            clen -= n;
           }
+        if (clen > 0)
+          evbuffer_drain (in, clen);
         
-        *consumed += plen + plen_len;
+        if (ret != Z_STREAM_END || this->strm_in.avail_out != 0)
+          return false;
         
-        // check for more packets
-        ptr += plen + plen_len;
-        switch (bin::got_varint (ptr, len - *consumed))
-          {
-          case -1:
-            delete[] out;
-            break;
-          
-          case 0:
-            goto done;
-          }
+        v.iov_len = hdr_len + dlen;
+        if (evbuffer_commit_space (out, &v, 1) != 0)
+          return false;
       }
-    
-  done:
-    *outp = out;
-    *out_len = outl;
-    return true;
   }
   
+#define ZLIB_HEADER_ROOM    10  // room for the packet and data lengths
+  
   bool
-  zlib_mc18_transformer::transform_out (const unsigned char *data,
-    unsigned int len, unsigned char **outp, int *out_len)
+  zlib_mc18_transformer::transform_out (struct evbuffer *in,
+    struct evbuffer *out)
   {
+    unsigned char hdr[ZLIB_HEADER_ROOM];
+    int hdr_len = (int)evbuffer_copyout (in, hdr, 5);
+    if (hdr_len <= 0 || bin::got_varint (hdr, hdr_len) != 1)
+      return false;
+    
     int dlen_len;
-    int dlen = bin::read_varint (data, &dlen_len);
+    int dlen = bin::read_varint (hdr, &dlen_len);
+    evbuffer_drain (in, dlen_len);
     
     if (dlen < this->threshold)
       {
         // no compression needed, simply wrap in proper packet format
-        int plen = len - dlen_len + 1;
-        int plen_len = bin::varint_size (plen);
-        
-        unsigned char *out = new unsigned char [plen_len + plen];
-        bin::write_varint (out, plen);
-        bin::write_varint (out + plen_len, 0);
-        std::memcpy (out + plen_len + 1, data + dlen_len, dlen);
+        hdr_len = bin::write_varint (hdr, dlen + 1);
+        hdr[hdr_len ++] = 0;
         
-        *outp = out;
-        *out_len = plen_len + plen;
+        evbuffer_add_buffer (out, in);
+        return (evbuffer_prepend (out, hdr, hdr_len) == 0);
       }
-    else
+    
+    // compress packet
+    
+    deflateReset (&this->strm_out);
+    
+    int out_cap = deflateBound (&this->strm_out, dlen);
+    struct evbuffer_iovec v;
+    if (evbuffer_reserve_space (out, out_cap + ZLIB_HEADER_ROOM, &v, 1) != 1)
+      return false;
+    
+    // the compressed data is written after some headroom, that is later
+    // drained and partially reclaimed by the packet header.
+    this->strm_out.avail_out = out_cap;
+    this->strm_out.next_out = static_cast<Bytef *> (v.iov_base) + ZLIB_HEADER_ROOM;
+    while (evbuffer_get_length (in) > 0)
       {
-        // compress packet
-        
-        deflateReset (&this->strm_out);
-        
-        int out_cap = deflateBound (&this->strm_out, len);
-        unsigned char *out = new unsigned char [out_cap + 10];
-        
-        int dlen_len;
-        int dlen = bin::read_varint (data, &dlen_len);
-        
-        this->strm_out.avail_in = len - dlen_len;
-        this->strm_out.next_in = (Bytef *)(data + dlen_len);
-        this->strm_out.avail_out = out_cap;
-        this->strm_out.next_out = out;
-        
-        auto ret = deflate (&this->strm_out, Z_FINISH);
-        if (ret != Z_STREAM_END)
-          {
-            delete[] out;
-            return false;
-          }
-        
-        int compressed_len = out_cap - this->strm_out.avail_out;
-        int plen = compressed_len + dlen_len;
-        int plen_len = bin::varint_size (plen);
+        struct evbuffer_iovec iv;
+        evbuffer_peek (in, -1, NULL, &iv, 1);
         
-        unsigned char *fout = new unsigned char [plen + plen_len];
-        bin::write_varint (fout, plen);
-        bin::write_varint (fout + plen_len, dlen);
-        std::memcpy (fout + plen_len + dlen_len, out, compressed_len);
-        delete[] out;
+        this->strm_out.avail_in = (uInt)iv.iov_len;
+        this->strm_out.next_in = static_cast<Bytef *> (iv.iov_base);
+        bool last = (iv.iov_len == evbuffer_get_length (in));
+        auto ret = deflate (&this->strm_out, last ? Z_FINISH : Z_NO_FLUSH);
+        if (last ? (ret != Z_STREAM_END) : (ret != Z_OK))
+          return false;
         
-        *outp = fout;
-        *out_len = plen + plen_len;
+        evbuffer_drain (in, iv.iov_len);
       }
     
-    return true;
-  }
-  
-  int
-  zlib_mc18_transformer::estimate_in (unsigned int len)
-  {
-    return len * 4;
-  }
-  
-  int
-  zlib_mc18_transformer::estimate_out (unsigned int len)
-  {
-    return deflateBound (&this->strm_out, len);
-  }
-  
-  int
-  zlib_mc18_transformer::in_enough (const unsigned char *data,
-    unsigned int len)
-  {
-    switch (bin::got_varint (data, len))
-      {
-      case 0:
-        return 0;
-      
-      case 1:
-        {
-          int plen_len;
-          int plen = bin::read_varint (data, &plen_len);
-          if ((int)len >= plen + plen_len)
-            return 1;
-          return 0;
-        }
-      
-      default:
-        return -1;
-      }
+    int compressed_len = out_cap - this->strm_out.avail_out;
+    v.iov_len = ZLIB_HEADER_ROOM + compressed_len;
+    if (evbuffer_commit_space (out, &v, 1) != 0)
+      return false;
+    evbuffer_drain (out, ZLIB_HEADER_ROOM);
+    
+    hdr_len = bin::write_varint (hdr, compressed_len + dlen_len);
+    hdr_len += bin::write_varint (hdr + hdr_len, dlen);
+    return (evbuffer_prepend (out, hdr, hdr_len) == 0);
   }
   
-  
-  
   /* 
    * Initializes the transformer with the specified threshold value and
    * compression level.
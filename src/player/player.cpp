@@ -18,6 +18,7 @@
 
 #include "player/player.hpp"
 #include "network/packet.hpp"
+#include "network/shared_packet.hpp"
 #include "network/connection.hpp"
 #include "network/protocol.hpp"
 #include "network/packet_builder.hpp"
@@ -59,8 +60,11 @@ namespace hc {
       std::chrono::high_resolution_clock::now ().time_since_epoch ()).count ());
     
     this->ka_expecting = false;
+    this->ping = 0;
+    this->list_changes = 0;
     this->w = nullptr;
     this->spawned = false;
+    this->stream_deferred = false;
     this->gen_tok = 0;
     this->openw = nullptr;
     this->cur_slot = 0;
@@ -123,6 +127,8 @@ namespace hc {
   
   
   
+#define KEEP_ALIVE_TIMEOUT      30000 // in milliseconds
+  
   /* 
    * Sends a Keep-Alive packet to the player.
    * After the packet is sent, the client is then expected to respond with
@@ -132,17 +138,15 @@ namespace hc {
   player::send_keep_alive ()
   {
     if (this->ka_expecting)
-      {
-        // TODO: kick the player (reason: timed out)
-        this->conn.disconnect ();
-        return;
-      }
+      return; // the connection's deadline takes care of unresponsive clients
     
     this->ka_id = this->rnd ();
     this->ka_expecting = true;
+    this->ka_sent = std::chrono::steady_clock::now ();
     
     auto builder = this->conn.get_protocol ()->get_builder ();
     this->conn.send (builder->make_keep_alive (this->ka_id));
+    this->conn.set_deadline (CONN_DEADLINE_KEEP_ALIVE, KEEP_ALIVE_TIMEOUT);
   }
   
   /* 
@@ -153,7 +157,15 @@ namespace hc {
   player::handle_keep_alive (int id)
   {
     if (this->ka_expecting && id == this->ka_id)
-      this->ka_expecting = false;
+      {
+        this->ka_expecting = false;
+        this->conn.clear_deadline (CONN_DEADLINE_KEEP_ALIVE);
+        
+        // the round trip time is shown in the tab list.
+        this->ping = (int)std::chrono::duration_cast<std::chrono::milliseconds> (
+          std::chrono::steady_clock::now () - this->ka_sent).count ();
+        this->list_changes |= PLC_PING;
+      }
   }
   
   
@@ -165,20 +177,107 @@ namespace hc {
   void
   player::on_chunk_loaded (chunk *ch, int x, int z)
   {
-    if (this->conn.is_disconnected ())
+    if (!this->claim_chunk (x, z))
       return;
     
     // TODO: generalize
     auto builder = dynamic_cast<mc18_packet_builder *> (
       this->conn.get_protocol ()->get_builder ());
     
-    unsigned short mask = 0;
-    for (int i = 0; i < 16; ++i)
-      if (ch->get_sub (i))
-        mask |= 1 << i;
+    // the chunk's data packet (and its compressed form) is shared by every
+    // player that sees the chunk.
+    shared_packet *sp = ch->get_data_packet (
+      this->conn.get_protocol ()->get_name (),
+      [builder, ch, x, z] () -> packet* {
+        unsigned short mask = 0;
+        for (int i = 0; i < 16; ++i)
+          if (ch->get_sub (i))
+            mask |= 1 << i;
+        
+        return builder->make_chunk_data (x, z, true, mask, ch);
+      });
+    this->conn.send (sp);
+    sp->release ();
     
-    this->conn.send (builder->make_chunk_data (x, z, true, mask, ch));
-    this->vis_chunks.emplace (x, z);
+    this->on_chunk_sent (x, z);
+  }
+  
+  /* 
+   * Checks whether the chunk at the specified coordinates should be sent
+   * to the player, and if so, marks it as visible.
+   */
+  bool
+  player::claim_chunk (int x, int z)
+  {
+    if (this->conn.is_disconnected ())
+      return false;
+    if (this->conn.is_congested ())
+      {
+        // the client is not keeping up, try again once the send queue
+        // drains (see tick()).
+        this->stream_deferred = true;
+        return false;
+      }
+    
+    // the chunk is marked visible before its data is taken, so that blocks
+    // modified in the meantime are broadcast to the player as well.
+    std::lock_guard<std::mutex> guard { this->vis_mtx };
+    return this->vis_chunks.emplace (x, z).second;
+  }
+  
+  /* 
+   * Sends the specified chunks to the player packed in as few Map Chunk
+   * Bulk packets as the configured size limit allows.
+   */
+  void
+  player::send_chunk_bulk (const std::vector<chunk *>& chs)
+  {
+    // TODO: generalize
+    auto builder = dynamic_cast<mc18_packet_builder *> (
+      this->conn.get_protocol ()->get_builder ());
+    int limit = this->srv.get_config ().chunk_bulk;
+    
+    size_t first = 0;
+    int size = 0;
+    for (size_t i = 0; i <= chs.size (); ++i)
+      {
+        int csize = 0;
+        if (i < chs.size ())
+          {
+            csize = 10 + 256;
+            for (int j = 0; j < 16; ++j)
+              if (chs[i]->get_sub (j))
+                csize += 12288;
+            if (i == first || size + csize <= limit)
+              {
+                size += csize;
+                continue;
+              }
+          }
+        
+        this->conn.send (builder->make_map_chunk_bulk (&chs[first],
+          (int)(i - first)));
+        for (size_t j = first; j < i; ++j)
+          {
+            chunk_pos cp = chs[j]->get_pos ();
+            this->on_chunk_sent (cp.x, cp.z);
+          }
+        
+        first = i;
+        size = csize;
+      }
+  }
+  
+  /* 
+   * Spawns the player once the chunk it is supposed to spawn on has been
+   * sent.
+   */
+  void
+  player::on_chunk_sent (int x, int z)
+  {
+    // TODO: generalize
+    auto builder = dynamic_cast<mc18_packet_builder *> (
+      this->conn.get_protocol ()->get_builder ());
     
     if (!this->spawned && (chunk_pos (x, z) == chunk_pos (this->spawn_pos)))
       {
@@ -228,14 +327,17 @@ namespace hc {
     
     // build list of chunks that are no longer in range.
     std::vector<chunk_pos> to_unload;
-    for (chunk_pos cp : this->vis_chunks)
-      if (!(cp.x >= (me_pos.x - VISIBILITY_RADIUS) &&
-        cp.x <= (me_pos.x + VISIBILITY_RADIUS) && 
-        cp.z >= (me_pos.z - VISIBILITY_RADIUS) && 
-        cp.z <= (me_pos.z + VISIBILITY_RADIUS)))
-        {
-          to_unload.push_back (cp);
-        }
+    {
+      std::lock_guard<std::mutex> vis_guard { this->vis_mtx };
+      for (chunk_pos cp : this->vis_chunks)
+        if (!(cp.x >= (me_pos.x - VISIBILITY_RADIUS) &&
+          cp.x <= (me_pos.x + VISIBILITY_RADIUS) && 
+          cp.z >= (me_pos.z - VISIBILITY_RADIUS) && 
+          cp.z <= (me_pos.z + VISIBILITY_RADIUS)))
+          {
+            to_unload.push_back (cp);
+          }
+    }
     
     // sort in-range chunks so that the closer ones are sent first
     std::sort (in_sight.begin (), in_sight.end (),
@@ -252,13 +354,18 @@ namespace hc {
     for (chunk_pos cp : to_unload)
       {
         this->conn.send (builder->make_unload_chunk (cp.x, cp.z));
+        
+        std::lock_guard<std::mutex> vis_guard { this->vis_mtx };
         this->vis_chunks.erase (cp);
       }
     
-    // send new chunks
+    // send new chunks.  chunks that are already loaded can be packed
+    // together into Map Chunk Bulk packets.
+    bool use_bulk = this->srv.get_config ().chunk_bulk > 0;
+    std::vector<chunk *> bulk;
     for (chunk_pos cp : in_sight)
       {
-        if (this->vis_chunks.find (cp) == this->vis_chunks.end ())
+        if (!this->can_see_chunk (cp))
           {
             player *me = this;
             chunk *ch = this->w->get_async_gen ().generate (this->gen_tok,
@@ -271,9 +378,17 @@ namespace hc {
                 }, &this->refc);
             
             if (ch)
-              this->on_chunk_loaded (ch, cp.x, cp.z);
+              {
+                if (!use_bulk)
+                  this->on_chunk_loaded (ch, cp.x, cp.z);
+                else if (this->claim_chunk (cp.x, cp.z))
+                  bulk.push_back (ch);
+              }
           }
       }
+    
+    if (!bulk.empty ())
+      this->send_chunk_bulk (bulk);
   }
   
   
@@ -318,6 +433,7 @@ namespace hc {
   player::set_gm (game_mode gm)
   {
     this->gm = gm;
+    this->list_changes |= PLC_GAMEMODE;
     
     // TODO: respawn
   }
@@ -437,11 +553,51 @@ namespace hc {
     
     log (LT_CHAT) << this->get_username () << ": " << msg << std::endl;
     
-    player *me = this;
-    this->srv.all_players (
-      [me, &msg] (player *pl) {
-        pl->message () << "§e" << me->get_username () << "§f: " << msg << endm;
-      });
+    // the message is built once, and shared between all recipients.
+    std::string text = this->get_username () + "§f: " + msg;
+    int radius = this->srv.get_config ().chat_radius;
+    if (radius > 0)
+      {
+        text = "§e" + text;
+        protocol_packet chat (
+          [&text] (packet_builder *builder) {
+            return builder->make_chat_message (text);
+          });
+        
+        // local chat: only players within the radius hear the message.
+        std::vector<player *> hearers;
+        {
+          double r2 = (double)radius * radius;
+          auto nearby = this->w->get_entity_grid ().query (
+            this->pos.x - radius, this->pos.z - radius,
+            this->pos.x + radius, this->pos.z + radius);
+          for (entity *ent : nearby)
+            {
+              player_entity *pent = dynamic_cast<player_entity *> (ent);
+              if (!pent)
+                continue;
+              
+              entity_pos epos = ent->get_pos ();
+              double xd = epos.x - this->pos.x;
+              double zd = epos.z - this->pos.z;
+              if (xd*xd + zd*zd <= r2)
+                hearers.push_back (pent->get_player ());
+            }
+        }
+        std::sort (hearers.begin (), hearers.end ());
+        
+        // the grid must not be locked while sending (which locks the
+        // receiving connection), and players that have left since are
+        // skipped.
+        this->srv.all_players (
+          [&hearers, &chat] (player *pl) {
+            if (std::binary_search (hearers.begin (), hearers.end (), pl))
+              chat.send_to (pl->get_connection ());
+          });
+        return;
+      }
+    
+    this->srv.broadcast_message (text);
   }
   
   
@@ -537,6 +693,38 @@ namespace hc {
   
   
   
+  /* 
+   * Invoked by the underlying packet handler when the player starts or stops
+   * sneaking, sprinting, etc.
+   */
+  void
+  player::on_action (entity_action action)
+  {
+    if (this->conn.is_disconnected () || !this->spawned)
+      return;
+    
+    switch (action)
+      {
+      case EA_START_SNEAKING:
+        this->pent->set_flag (EF_CROUCHED, true);
+        break;
+      case EA_STOP_SNEAKING:
+        this->pent->set_flag (EF_CROUCHED, false);
+        break;
+      
+      case EA_START_SPRINTING:
+        this->pent->set_flag (EF_SPRINTING, true);
+        break;
+      case EA_STOP_SPRINTING:
+        this->pent->set_flag (EF_SPRINTING, false);
+        break;
+      
+      default: ;
+      }
+  }
+  
+  
+  
 //------------------------------------------------------------------------------
   
   
@@ -547,7 +735,18 @@ namespace hc {
   void
   player::tick ()
   {
-    
+    if (!this->conn.is_congested () && this->stream_deferred.exchange (false))
+      {
+        // this is called on the connection's I/O thread, with the
+        // connection locked; chunks are compressed and sent from the
+        // thread pool instead.
+        bool queued = this->srv.get_thread_pool ().enqueue (
+          [this] (void *) {
+            this->stream_chunks ();
+          }, nullptr, this->refc);
+        if (!queued)
+          this->stream_deferred = true;
+      }
   }
 }
 
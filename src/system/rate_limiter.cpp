@@ -0,0 +1,110 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system/rate_limiter.hpp"
+#include <functional>
+
+
+namespace hc {
+  
+  rate_limiter::rate_limiter ()
+  {
+    this->rate = 0.0;
+    this->burst = 0.0;
+    this->dropped = 0;
+  }
+  
+  
+  
+  /* 
+   * Sets the rate (in tokens per second) and the burst size of every
+   * bucket.  A rate of zero disables the limiter.
+   */
+  void
+  rate_limiter::configure (double rate, double burst)
+  {
+    this->rate = (rate < 0.0) ? 0.0 : rate;
+    this->burst = (burst < 1.0) ? 1.0 : burst;
+  }
+  
+  
+  
+  /* 
+   * Attempts to take the specified amount of tokens from the bucket of the
+   * given address.  Returns false (and counts the tokens as dropped) if
+   * there are not enough tokens left.
+   */
+  bool
+  rate_limiter::consume (const char *ip, int count)
+  {
+    if (!this->is_enabled ())
+      return true;
+    
+    std::string key { ip };
+    shard& sh = this->shards[std::hash<std::string> () (key) % RATE_LIMITER_SHARDS];
+    auto now = std::chrono::steady_clock::now ();
+    
+    std::lock_guard<std::mutex> guard { sh.mtx };
+    auto itr = sh.buckets.find (key);
+    if (itr == sh.buckets.end ())
+      itr = sh.buckets.emplace (std::move (key), bucket { this->burst, now }).first;
+    
+    // refill
+    bucket& b = itr->second;
+    double elapsed = std::chrono::duration<double> (now - b.last).count ();
+    b.tokens += elapsed * this->rate;
+    if (b.tokens > this->burst)
+      b.tokens = this->burst;
+    b.last = now;
+    
+    if (b.tokens < count)
+      {
+        this->dropped += count;
+        return false;
+      }
+    
+    b.tokens -= count;
+    return true;
+  }
+  
+  
+  
+  /* 
+   * Removes buckets that have been refilled completely, and so hold no
+   * information worth keeping.
+   */
+  void
+  rate_limiter::cleanup ()
+  {
+    auto now = std::chrono::steady_clock::now ();
+    for (shard& sh : this->shards)
+      {
+        std::lock_guard<std::mutex> guard { sh.mtx };
+        for (auto itr = sh.buckets.begin (); itr != sh.buckets.end (); )
+          {
+            bucket& b = itr->second;
+            double elapsed = std::chrono::duration<double> (now - b.last).count ();
+            if (b.tokens + elapsed * this->rate >= this->burst)
+              itr = sh.buckets.erase (itr);
+            else
+              ++ itr;
+          }
+      }
+  }
+}
+
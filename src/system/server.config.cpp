@@ -32,12 +32,36 @@ namespace hc {
     cfg.online = true;
     
     cfg.port = 25565;
+    cfg.workers = 0;
+    cfg.reuse_port = true;
     cfg.encryption = true;
     cfg.compress_threshold = 256;
     cfg.compress_level = 6;
+    cfg.tcp_nodelay = true;
+    cfg.tcp_cork = true;
+    cfg.flush_window = 0;
+    cfg.max_packet_size = 32768;
+    cfg.send_budget = 8388608;
+    cfg.send_policy = SBP_DEFER;
+    cfg.send_grace = 10000;
+    cfg.send_mode = SSM_WEIGHTED;
+    cfg.send_weights[0] = 8;
+    cfg.send_weights[1] = 4;
+    cfg.send_weights[2] = 2;
+    cfg.send_weights[3] = 1;
+    cfg.send_window = 65536;
+    cfg.login_timeout = 30000;
+    cfg.connect_rate = 2;
+    cfg.connect_burst = 10;
+    cfg.packet_rate = 250;
+    cfg.packet_burst = 1000;
+    cfg.capture = false;
+    cfg.capture_dir = "captures";
     
     cfg.mainw = "Main";
     cfg.view_dist = 3;
+    cfg.chunk_bulk = 0;
+    cfg.chat_radius = 0;
   }
   
   
@@ -61,7 +85,34 @@ namespace hc {
     fs << "\n";
     fs << "  \"net\": {\n";
     fs << "    \"port\": 25565,\n";
+    fs << "    \"workers\": 0,\n";
+    fs << "    \"reuse-port\": true,\n";
     fs << "    \"encryption\": true,\n";
+    fs << "    \"tcp-nodelay\": true,\n";
+    fs << "    \"tcp-cork\": true,\n";
+    fs << "    \"flush-window\": 0,\n";
+    fs << "    \"max-packet-size\": 32768,\n";
+    fs << "    \"login-timeout\": 30000,\n";
+    fs << "    \"send-budget\": {\n";
+    fs << "      \"bytes\": 8388608,\n";
+    fs << "      \"policy\": \"defer\",\n";
+    fs << "      \"grace\": 10000,\n";
+    fs << "    },\n";
+    fs << "    \"rate-limit\": {\n";
+    fs << "      \"connect-rate\": 2,\n";
+    fs << "      \"connect-burst\": 10,\n";
+    fs << "      \"packet-rate\": 250,\n";
+    fs << "      \"packet-burst\": 1000,\n";
+    fs << "    },\n";
+    fs << "    \"capture\": {\n";
+    fs << "      \"enabled\": false,\n";
+    fs << "      \"dir\": \"captures\",\n";
+    fs << "    },\n";
+    fs << "    \"send-priority\": {\n";
+    fs << "      \"mode\": \"weighted\",\n";
+    fs << "      \"weights\": [8, 4, 2, 1],\n";
+    fs << "      \"window\": 65536,\n";
+    fs << "    },\n";
     fs << "    \"compression\": {\n";
     fs << "      \"threshold\": 256,\n";
     fs << "      \"level\": 6,\n";
@@ -71,6 +122,8 @@ namespace hc {
     fs << "  \"worlds\": {\n";
     fs << "    \"main-world\": \"Main\",\n";
     fs << "    \"view-distance\": 3,\n";
+    fs << "    \"chunk-bulk\": 0,\n";
+    fs << "    \"chat-radius\": 0,\n";
     fs << "  }\n";
     fs << "}";
     
@@ -108,6 +161,148 @@ namespace hc {
       log (LT_WARNING) << "  config: `general.online' not found, using default." << std::endl;
   }
   
+  static void
+  _cfg_load_net_send_budget (json::j_object *obj, server::configuration& cfg, logger& log)
+  {
+    if (!obj)
+      {
+        log (LT_FATAL) << "  config: `net.send-budget' must be an object" << std::endl;
+        throw server_start_error ("config: `net.send-budget' must be an object");
+      }
+    
+    // send-budget.bytes
+    if (obj->get ("bytes"))
+      cfg.send_budget = (int)obj->get ("bytes")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `net.send-budget.bytes' not found, using default." << std::endl;
+    
+    // send-budget.policy
+    if (obj->get ("policy"))
+      {
+        std::string policy = obj->get ("policy")->as_string ();
+        if (policy == "defer")
+          cfg.send_policy = SBP_DEFER;
+        else if (policy == "drop")
+          cfg.send_policy = SBP_DROP;
+        else if (policy == "disconnect")
+          cfg.send_policy = SBP_DISCONNECT;
+        else
+          log (LT_WARNING) << "  config: invalid `net.send-budget.policy', using default." << std::endl;
+      }
+    else
+      log (LT_WARNING) << "  config: `net.send-budget.policy' not found, using default." << std::endl;
+    
+    // send-budget.grace
+    if (obj->get ("grace"))
+      cfg.send_grace = (int)obj->get ("grace")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `net.send-budget.grace' not found, using default." << std::endl;
+  }
+  
+  static void
+  _cfg_load_net_send_priority (json::j_object *obj, server::configuration& cfg, logger& log)
+  {
+    if (!obj)
+      {
+        log (LT_FATAL) << "  config: `net.send-priority' must be an object" << std::endl;
+        throw server_start_error ("config: `net.send-priority' must be an object");
+      }
+    
+    // send-priority.mode
+    if (obj->get ("mode"))
+      {
+        std::string mode = obj->get ("mode")->as_string ();
+        if (mode == "strict")
+          cfg.send_mode = SSM_STRICT;
+        else if (mode == "weighted")
+          cfg.send_mode = SSM_WEIGHTED;
+        else
+          log (LT_WARNING) << "  config: invalid `net.send-priority.mode', using default." << std::endl;
+      }
+    else
+      log (LT_WARNING) << "  config: `net.send-priority.mode' not found, using default." << std::endl;
+    
+    // send-priority.weights
+    if (obj->get ("weights"))
+      {
+        json::j_array *arr = obj->get ("weights")->as_array ();
+        if (arr && arr->size () == 4)
+          {
+            for (int i = 0; i < 4; ++i)
+              {
+                int w = (int)arr->get_values ()[i]->as_number ();
+                cfg.send_weights[i] = (w < 1) ? 1 : w;
+              }
+          }
+        else
+          log (LT_WARNING) << "  config: `net.send-priority.weights' must have four elements, using default." << std::endl;
+      }
+    else
+      log (LT_WARNING) << "  config: `net.send-priority.weights' not found, using default." << std::endl;
+    
+    // send-priority.window
+    if (obj->get ("window"))
+      cfg.send_window = (int)obj->get ("window")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `net.send-priority.window' not found, using default." << std::endl;
+  }
+  
+  static void
+  _cfg_load_net_rate_limit (json::j_object *obj, server::configuration& cfg, logger& log)
+  {
+    if (!obj)
+      {
+        log (LT_FATAL) << "  config: `net.rate-limit' must be an object" << std::endl;
+        throw server_start_error ("config: `net.rate-limit' must be an object");
+      }
+    
+    // rate-limit.connect-rate
+    if (obj->get ("connect-rate"))
+      cfg.connect_rate = obj->get ("connect-rate")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `net.rate-limit.connect-rate' not found, using default." << std::endl;
+    
+    // rate-limit.connect-burst
+    if (obj->get ("connect-burst"))
+      cfg.connect_burst = (int)obj->get ("connect-burst")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `net.rate-limit.connect-burst' not found, using default." << std::endl;
+    
+    // rate-limit.packet-rate
+    if (obj->get ("packet-rate"))
+      cfg.packet_rate = obj->get ("packet-rate")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `net.rate-limit.packet-rate' not found, using default." << std::endl;
+    
+    // rate-limit.packet-burst
+    if (obj->get ("packet-burst"))
+      cfg.packet_burst = (int)obj->get ("packet-burst")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `net.rate-limit.packet-burst' not found, using default." << std::endl;
+  }
+  
+  static void
+  _cfg_load_net_capture (json::j_object *obj, server::configuration& cfg, logger& log)
+  {
+    if (!obj)
+      {
+        log (LT_FATAL) << "  config: `net.capture' must be an object" << std::endl;
+        throw server_start_error ("config: `net.capture' must be an object");
+      }
+    
+    // capture.enabled
+    if (obj->get ("enabled"))
+      cfg.capture = obj->get ("enabled")->as_bool ();
+    else
+      log (LT_WARNING) << "  config: `net.capture.enabled' not found, using default." << std::endl;
+    
+    // capture.dir
+    if (obj->get ("dir"))
+      cfg.capture_dir = obj->get ("dir")->as_string ();
+    else
+      log (LT_WARNING) << "  config: `net.capture.dir' not found, using default." << std::endl;
+  }
+  
   static void
   _cfg_load_net_compression (json::j_object *obj, server::configuration& cfg, logger& log)
   {
@@ -145,12 +340,78 @@ namespace hc {
     else
       log (LT_WARNING) << "  config: `net.port' not found, using default." << std::endl;
     
+    // net.workers
+    if (obj->get ("workers"))
+      cfg.workers = (int)obj->get ("workers")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `net.workers' not found, using default." << std::endl;
+    
+    // net.reuse-port
+    if (obj->get ("reuse-port"))
+      cfg.reuse_port = obj->get ("reuse-port")->as_bool ();
+    else
+      log (LT_WARNING) << "  config: `net.reuse-port' not found, using default." << std::endl;
+    
     // net.encryption
     if (obj->get ("encryption"))
       cfg.encryption = obj->get ("encryption")->as_bool ();
     else
       log (LT_WARNING) << "  config: `net.encryption' not found, using default." << std::endl;
     
+    // net.tcp-nodelay
+    if (obj->get ("tcp-nodelay"))
+      cfg.tcp_nodelay = obj->get ("tcp-nodelay")->as_bool ();
+    else
+      log (LT_WARNING) << "  config: `net.tcp-nodelay' not found, using default." << std::endl;
+    
+    // net.tcp-cork
+    if (obj->get ("tcp-cork"))
+      cfg.tcp_cork = obj->get ("tcp-cork")->as_bool ();
+    else
+      log (LT_WARNING) << "  config: `net.tcp-cork' not found, using default." << std::endl;
+    
+    // net.flush-window
+    if (obj->get ("flush-window"))
+      cfg.flush_window = (int)obj->get ("flush-window")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `net.flush-window' not found, using default." << std::endl;
+    
+    // net.max-packet-size
+    if (obj->get ("max-packet-size"))
+      cfg.max_packet_size = (int)obj->get ("max-packet-size")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `net.max-packet-size' not found, using default." << std::endl;
+    
+    // net.login-timeout
+    if (obj->get ("login-timeout"))
+      cfg.login_timeout = (int)obj->get ("login-timeout")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `net.login-timeout' not found, using default." << std::endl;
+    
+    // net.send-budget
+    if (obj->get ("send-budget"))
+      _cfg_load_net_send_budget (obj->get ("send-budget")->as_object (), cfg, log);
+    else
+      log (LT_WARNING) << "  config: `net.send-budget' not found, using default." << std::endl;
+    
+    // net.rate-limit
+    if (obj->get ("rate-limit"))
+      _cfg_load_net_rate_limit (obj->get ("rate-limit")->as_object (), cfg, log);
+    else
+      log (LT_WARNING) << "  config: `net.rate-limit' not found, using default." << std::endl;
+    
+    // net.capture
+    if (obj->get ("capture"))
+      _cfg_load_net_capture (obj->get ("capture")->as_object (), cfg, log);
+    else
+      log (LT_WARNING) << "  config: `net.capture' not found, using default." << std::endl;
+    
+    // net.send-priority
+    if (obj->get ("send-priority"))
+      _cfg_load_net_send_priority (obj->get ("send-priority")->as_object (), cfg, log);
+    else
+      log (LT_WARNING) << "  config: `net.send-priority' not found, using default." << std::endl;
+    
     // net.compression
     _cfg_load_net_compression (obj->get ("compression")->as_object (), cfg, log);
   }
@@ -175,6 +436,18 @@ namespace hc {
       cfg.view_dist = (int)obj->get ("view-distance")->as_number ();
     else
       log (LT_WARNING) << "  config: `worlds.view-distance' not found, using default." << std::endl;
+    
+    // worlds.chunk-bulk
+    if (obj->get ("chunk-bulk"))
+      cfg.chunk_bulk = (int)obj->get ("chunk-bulk")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `worlds.chunk-bulk' not found, using default." << std::endl;
+    
+    // worlds.chat-radius
+    if (obj->get ("chat-radius"))
+      cfg.chat_radius = (int)obj->get ("chat-radius")->as_number ();
+    else
+      log (LT_WARNING) << "  config: `worlds.chat-radius' not found, using default." << std::endl;
   }
   
   static void
@@ -194,6 +467,23 @@ namespace hc {
   
   void
   server::init_config ()
+  {
+    this->load_config ();
+    
+    if (this->offline)
+      {
+        // nothing reaches an offline server over the network, so there is
+        // no one to authenticate, encrypt for, rate limit or record.
+        this->cfg.online = false;
+        this->cfg.encryption = false;
+        this->cfg.connect_rate = 0;
+        this->cfg.packet_rate = 0;
+        this->cfg.capture = false;
+      }
+  }
+  
+  void
+  server::load_config ()
   {
     log (LT_SYSTEM) << "Loading server configuration..." << std::endl;
     
@@ -30,6 +30,9 @@
 #include "cmd/command.hpp"
 #include "player/uuid_manager.hpp"
 #include "system/authenticator.hpp"
+#include "network/transformers/aes.hpp"
+#include "network/shared_packet.hpp"
+#include "network/packet_builder.hpp"
 #include <chrono>
 #include <cstring>
 #include <algorithm>
@@ -38,6 +41,7 @@
 #include <event2/listener.h>
 #include <sstream>
 #include <memory>
+#include <thread>
 #include <cryptopp/osrng.h>
 #include <signal.h>
 
@@ -58,6 +62,12 @@ namespace hc {
   {
     this->running = false;
     this->started = false;
+    this->offline = false;
+    this->pipe_event = nullptr;
+    this->queued_bytes = 0;
+    this->capture_id = 0;
+    this->status_pack = nullptr;
+    this->status_players = -1;
     
     // <init, fin> pairs
     this->inits.emplace_back (&server::first_init, &server::last_fin);
@@ -108,32 +118,128 @@ namespace hc {
     
     worker *w = this->workers[index];
     
+    // block inside libevent's dispatch loop.  other threads wake the loop up
+    // by activating events (libevent's threading support takes care of the
+    // notification), and fin_workers() breaks out of it.
     while (this->running)
+      event_base_dispatch (w->evbase);
+  }
+  
+  
+  
+#define WORKER_PROBE_INTERVAL   100   // in milliseconds
+#define WORKER_RATE_PROBES      10    // probes between throughput updates
+  
+  /* 
+   * Called periodically by every worker's event loop to measure its
+   * latency.
+   */
+  void
+  server::on_probe (evutil_socket_t sock, short what, void *arg)
+  {
+    worker *w = static_cast<worker *> (arg);
+    if (!w->srv->running)
       {
-        std::this_thread::sleep_for (std::chrono::milliseconds (10));
-        
-        event_base_loop (w->evbase, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+        // in case fin_workers() tried to break out of the loop before the
+        // worker thread entered it.
+        event_base_loopbreak (w->evbase);
+        return;
       }
+    
+    auto now = std::chrono::steady_clock::now ();
+    long long lat = std::chrono::duration_cast<std::chrono::microseconds> (
+      now - w->probe_due).count ();
+    if (lat < 0)
+      lat = 0;
+    
+    auto& st = w->stats;
+    ++ st.iterations;
+    st.lat_last = lat;
+    st.lat_avg = (st.lat_avg * 7 + lat) / 8;
+    if (lat > st.lat_max)
+      st.lat_max = lat;
+    
+    // update throughput
+    if (++ st.rate_probes >= WORKER_RATE_PROBES)
+      {
+        long long bytes = st.bytes;
+        st.bps = (bytes - st.last_bytes) * 1000
+          / (WORKER_PROBE_INTERVAL * WORKER_RATE_PROBES);
+        st.last_bytes = bytes;
+        st.rate_probes = 0;
+      }
+    
+    // reschedule
+    struct timeval tv = { 0, WORKER_PROBE_INTERVAL * 1000 };
+    w->probe_due = now + std::chrono::milliseconds (WORKER_PROBE_INTERVAL);
+    evtimer_add (w->probe, &tv);
   }
   
   
   
+#define WORKER_TICK_INTERVAL    20    // in milliseconds
+  
   /* 
-   * Returns the server worker that is currently handling the least amount
-   * of events, and increases its event count.
+   * Called by every worker's event loop once per tick to advance its
+   * timer wheel and tick the connections it handles.
+   */
+  void
+  server::on_tick (evutil_socket_t sock, short what, void *arg)
+  {
+    worker *w = static_cast<worker *> (arg);
+    
+    w->timers->advance ();
+    
+    // connections only get removed from the list by their worker (in
+    // connection::disconnect_), so none of them can be destroyed while
+    // they are being ticked.
+    {
+      std::lock_guard<std::mutex> guard { w->conns_mtx };
+      w->tick_conns.assign (w->conns.begin (), w->conns.end ());
+    }
+    
+    for (connection *conn : w->tick_conns)
+      conn->tick ();
+  }
+  
+  
+  
+#define WORKER_LOAD_BPS_UNIT    65536 // throughput equivalent to a connection
+#define WORKER_LOAD_SLACK       2     // in connections
+  
+  static long long
+  _worker_load (server::worker *w)
+  {
+    return (long long)w->stats.conns + w->stats.bps / WORKER_LOAD_BPS_UNIT;
+  }
+  
+  /* 
+   * Returns the server worker that currently has the least amount of load,
+   * based on its number of active connections and its throughput.
+   * If a preferred worker is specified, it is returned as long as its load
+   * is not much higher than that of the least loaded worker.
    */
   server::worker*
-  server::min_worker ()
+  server::min_worker (worker *pref)
   {
     std::lock_guard<std::mutex> guard { this->worker_mtx };
     
     worker *min = nullptr;
+    long long min_load = 0;
     for (worker *w : this->workers)
-      if (!min || w->evs > min->evs)
-        min = w;
+      {
+        long long load = _worker_load (w);
+        if (!min || load < min_load)
+          {
+            min = w;
+            min_load = load;
+          }
+      }
     
-    if (min)
-      ++ min->evs;
+    // staying on the accepting worker avoids migrating the socket to
+    // another thread's event base.
+    if (pref && _worker_load (pref) <= min_load + WORKER_LOAD_SLACK)
+      return pref;
     return min;
   }
   
@@ -146,7 +252,8 @@ namespace hc {
   server::on_accept (struct evconnlistener *listener, evutil_socket_t sock,
     struct sockaddr *addr, int len, void *ptr)
   {
-    server *srv = static_cast<server *> (ptr);
+    worker *w = static_cast<worker *> (ptr);
+    server *srv = w->srv;
     
     // get IP address
     char ip[INET_ADDRSTRLEN];
@@ -158,6 +265,13 @@ namespace hc {
         return;
       }
     
+    // turn connection floods away before anything gets allocated for them.
+    if (!srv->conn_limiter.consume (ip))
+      {
+        evutil_closesocket (sock);
+        return;
+      }
+    
     connection *conn = new connection (*srv, sock, ip);
     {
       std::lock_guard<std::recursive_mutex> guard { srv->conn_mtx };
@@ -166,7 +280,7 @@ namespace hc {
     
     srv->log (LT_DEBUG) << "Accepted connection from @" << ip << std::endl;
     conn->infer_protocol ();
-    conn->start_io ();
+    conn->start_io (w);
   }
   
   /* 
@@ -210,6 +324,20 @@ namespace hc {
     
     this->started = true;
   }
+  
+  /* 
+   * Starts the server up without listening for connections, for tools
+   * that drive connections by hand (e.g. the capture replayer).
+   */
+  void
+  server::start_offline ()
+  {
+    if (this->started)
+      return;
+    
+    this->offline = true;
+    this->start ();
+  }
  
   
   /* 
@@ -268,7 +396,7 @@ namespace hc {
         std::unique_lock<std::recursive_mutex> dc_guard { conn->get_dc_mutex () };
         
         player *pl = conn->get_player ();
-        if (!pl || conn->get_player ()->get_refc ().zero ())
+        if (conn->get_refc ().zero () && (!pl || pl->get_refc ().zero ()))
           {
             dc_guard.unlock ();
             delete conn;
@@ -282,6 +410,36 @@ namespace hc {
   
   
   
+  /* 
+   * Returns the response to server list pings for the specified protocol.
+   * The packet is cached, and only rebuilt (using the given function) when
+   * the player count or the MOTD changes.
+   * The returned packet is grabbed on the caller's behalf.
+   */
+  shared_packet*
+  server::get_status_packet (const std::string& proto,
+    std::function<packet* ()>&& build)
+  {
+    std::lock_guard<std::mutex> guard { this->status_mtx };
+    
+    int players = this->get_player_count ();
+    if (this->status_pack && this->status_players == players
+      && this->status_proto == proto && this->status_motd == this->cfg.motd)
+      return this->status_pack->grab ();
+    
+    shared_packet *sp = shared_packet::create (build ());
+    if (this->status_pack)
+      this->status_pack->release ();
+    this->status_pack = sp;
+    this->status_players = players;
+    this->status_proto = proto;
+    this->status_motd = this->cfg.motd;
+    
+    return sp->grab ();
+  }
+  
+  
+  
   /*
    * Inserts the specified player to the server's player list.
    * 
@@ -323,6 +481,35 @@ namespace hc {
       cb (pl);
   }
   
+  /* 
+   * Sends a packet to every player in the server.  The packet is built
+   * (and compressed) at most once per protocol, and shared between all
+   * connections.
+   */
+  void
+  server::broadcast (std::function<packet* (packet_builder *)>&& build)
+  {
+    protocol_packet pack (std::move (build));
+    
+    std::lock_guard<std::recursive_mutex> guard { this->conn_mtx };
+    for (player *pl : this->players)
+      pack.send_to (pl->get_connection ());
+  }
+  
+  /* 
+   * Sends the specified chat message to every player in the server
+   * (old-style formatting is used).
+   */
+  void
+  server::broadcast_message (const std::string& msg)
+  {
+    std::string text = "§e" + msg;
+    this->broadcast (
+      [&text] (packet_builder *builder) {
+        return builder->make_chat_message (text);
+      });
+  }
+  
   
   
   /* 
@@ -367,9 +554,9 @@ namespace hc {
   
   
   /* 
-   * Sends Keep-Alive packets to all connected players; and checks whether
-   * there exist any connections that did not respond with a keep alive
-   * packet within 20 seconds.
+   * Sends Keep-Alive packets to all connected players.  Players that do not
+   * respond in time are disconnected by their connection's keep-alive
+   * deadline.
    */
   void
   server::keep_alive (scheduler::task& task)
@@ -383,6 +570,55 @@ namespace hc {
   
   
   
+  /* 
+   * Logs the event loop statistics of all worker threads.
+   */
+  void
+  server::report_workers (scheduler::task& task)
+  {
+    std::lock_guard<std::mutex> guard { this->worker_mtx };
+    for (worker *w : this->workers)
+      {
+        auto& st = w->stats;
+        log (LT_DEBUG) << "Worker #" << w->index << ": loop latency: "
+          << st.lat_avg << "us avg, " << st.lat_last << "us last, "
+          << st.lat_max << "us max (" << st.iterations << " probes); "
+          << st.conns << " connection(s), " << st.bps << " B/s" << std::endl;
+        st.lat_max = 0;
+      }
+    
+    log (LT_DEBUG) << "Outbound queues: " << this->queued_bytes << " bytes" << std::endl;
+    log (LT_DEBUG) << "Rate limits: " << this->conn_limiter.get_dropped ()
+      << " connection(s), " << this->packet_limiter.get_dropped ()
+      << " packet(s) dropped" << std::endl;
+  }
+  
+  
+  
+  /* 
+   * Forgets about addresses that have not been rate limited recently.
+   */
+  void
+  server::cleanup_rate_limits (scheduler::task& task)
+  {
+    this->conn_limiter.cleanup ();
+    this->packet_limiter.cleanup ();
+  }
+  
+  /* 
+   * Runs once per game tick (50ms) to broadcast block changes and entity
+   * movement in all worlds.
+   */
+  void
+  server::tick_worlds (scheduler::task& task)
+  {
+    std::lock_guard<std::mutex> guard (this->world_mtx);
+    for (world *w : this->worlds)
+      w->tick ();
+  }
+  
+  
+  
 //------------------------------------------------------------------------------
   /* 
    * The initialization function is called before any other initialization
@@ -412,6 +648,12 @@ namespace hc {
   {
     delete this->uman;
     
+    if (this->status_pack)
+      {
+        this->status_pack->release ();
+        this->status_pack = nullptr;
+      }
+    
     this->tpool->release_seq (this->gen_seq,
       [] (void *ctx)
         {
@@ -437,6 +679,14 @@ namespace hc {
     CryptoPP::AutoSeededRandomPool rnd;
     this->rsa_p.GenerateRandomWithKeySize (rnd, 1024);
     
+    if (this->cfg.encryption)
+      {
+        if (aes_transformer::hardware_accelerated ())
+          log (LT_SYSTEM) << "AES: Using AES-NI instructions" << std::endl;
+        else
+          log (LT_WARNING) << "AES: AES-NI not available, encryption will be slower" << std::endl;
+      }
+    
     if (this->cfg.online)
       {
         this->uman->set_online ();
@@ -484,6 +734,8 @@ namespace hc {
         if (!w)
           continue;
         
+        if (this->offline)
+          w->set_persistent (false);
         this->worlds.push_back (w);
       }
     
@@ -510,6 +762,8 @@ namespace hc {
         this->mainw = new world (this->cfg.mainw, *this,
           world_generator::create ("flatgrass", ""),
           world_provider::create ("anvil"), 32, 32);
+        if (this->offline)
+          this->mainw->set_persistent (false);
         this->worlds.push_back (this->mainw);
       }
   }
@@ -567,7 +821,13 @@ namespace hc {
   
     std::lock_guard<std::mutex> guard { this->worker_mtx };
 
-    int wcount = DEFAULT_WORKER_THREAD_COUNT;
+    int wcount = this->cfg.workers;
+    if (wcount <= 0)
+      {
+        wcount = (int)std::thread::hardware_concurrency ();
+        if (wcount <= 0)
+          wcount = DEFAULT_WORKER_THREAD_COUNT;
+      }
     
     log (LT_SYSTEM) << "Starting " << wcount << " workers thread(s)..." << std::endl;
     
@@ -582,8 +842,16 @@ namespace hc {
           this, std::placeholders::_1), ctx);
         
         worker *w = new worker;
+        w->srv = this;
+        w->index = i;
         w->th = th;
-        w->evs = 0;
+        w->listener = nullptr;
+        w->stats.iterations = 0;
+        w->stats.lat_last = w->stats.lat_avg = w->stats.lat_max = 0;
+        w->stats.conns = 0;
+        w->stats.bytes = w->stats.bps = 0;
+        w->stats.last_bytes = 0;
+        w->stats.rate_probes = 0;
         
         // create event base
         w->evbase = event_base_new ();
@@ -594,6 +862,17 @@ namespace hc {
           }
         log (LT_DEBUG) << " - Method: " << event_base_get_method (w->evbase) << std::endl;
         
+        struct timeval tv = { 0, WORKER_PROBE_INTERVAL * 1000 };
+        w->probe = evtimer_new (w->evbase, &server::on_probe, w);
+        w->probe_due = std::chrono::steady_clock::now ()
+          + std::chrono::milliseconds (WORKER_PROBE_INTERVAL);
+        evtimer_add (w->probe, &tv);
+        
+        struct timeval ttv = { 0, WORKER_TICK_INTERVAL * 1000 };
+        w->timers = new timer_wheel (WORKER_TICK_INTERVAL);
+        w->tick = event_new (w->evbase, -1, EV_PERSIST, &server::on_tick, w);
+        event_add (w->tick, &ttv);
+        
         this->workers.push_back (w);
       }
     
@@ -607,12 +886,18 @@ namespace hc {
     std::lock_guard<std::mutex> guard { this->worker_mtx };
     this->running = false;
     
+    for (worker *w : this->workers)
+      event_base_loopbreak (w->evbase);
+    
     for (worker *w : this->workers)
       {
         if (w->th->joinable ())
           w->th->join ();
         delete w->th;
         
+        event_free (w->probe);
+        event_free (w->tick);
+        delete w->timers;
         event_base_free (w->evbase);
         
         delete w;
@@ -632,6 +917,18 @@ namespace hc {
   void
   server::init_listener ()
   {
+    this->conn_limiter.configure (this->cfg.connect_rate, this->cfg.connect_burst);
+    this->packet_limiter.configure (this->cfg.packet_rate, this->cfg.packet_burst);
+    
+    if (this->cfg.capture)
+      fs::create_dir (this->cfg.capture_dir);
+    
+    if (this->offline)
+      {
+        log (LT_SYSTEM) << "Running offline, not listening for connections" << std::endl;
+        return;
+      }
+    
     struct addrinfo hints, *res;
     
     std::ostringstream ss;
@@ -643,26 +940,42 @@ namespace hc {
     hints.ai_flags = AI_PASSIVE;
     getaddrinfo (NULL, ss.str ().c_str (), &hints, &res);
     
-    worker *w = this->min_worker ();
     std::lock_guard<std::mutex> guard { this->worker_mtx };
     
-    this->listener = evconnlistener_new_bind (w->evbase, &server::on_accept,
-      this, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1, res->ai_addr,
-      (int)res->ai_addrlen);
-    freeaddrinfo (res);
-      
-    if (!this->listener)
+    // with SO_REUSEPORT, every worker gets a listening socket of its own and
+    // the kernel distributes incoming connections between them.  otherwise,
+    // the first worker accepts all connections.
+    unsigned int flags = LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE;
+    int lcount = 1;
+#ifdef LEV_OPT_REUSEABLE_PORT
+    if (this->cfg.reuse_port)
       {
-        log (LT_FATAL) << "Could not start listening on port " << this->cfg.port << std::endl;
-        throw server_start_error ("could not start listening");
+        flags |= LEV_OPT_REUSEABLE_PORT;
+        lcount = (int)this->workers.size ();
       }
+#endif
+    
+    for (int i = 0; i < lcount; ++i)
+      {
+        worker *w = this->workers[i];
+        w->listener = evconnlistener_new_bind (w->evbase, &server::on_accept,
+          w, flags, -1, res->ai_addr, (int)res->ai_addrlen);
+        if (!w->listener)
+          {
+            freeaddrinfo (res);
+            log (LT_FATAL) << "Could not start listening on port " << this->cfg.port << std::endl;
+            throw server_start_error ("could not start listening");
+          }
+      }
+    freeaddrinfo (res);
     
-    log (LT_SYSTEM) << "Started listening on port " << this->cfg.port << std::endl;
+    log (LT_SYSTEM) << "Started listening on port " << this->cfg.port
+      << " (" << lcount << " listener(s))" << std::endl;
     
     // we also bind a handler for SIGPIPE here
 #ifndef WIN32
-    this->pipe_event = evsignal_new (w->evbase, SIGPIPE, &server::on_signal,
-      this);
+    this->pipe_event = evsignal_new (this->workers[0]->evbase, SIGPIPE,
+      &server::on_signal, this);
     evsignal_add (this->pipe_event, NULL);
 #endif
   }
@@ -670,10 +983,20 @@ namespace hc {
   void
   server::fin_listener ()
   {
-    evconnlistener_free (this->listener);
+    std::lock_guard<std::mutex> guard { this->worker_mtx };
+    for (worker *w : this->workers)
+      if (w->listener)
+        {
+          evconnlistener_free (w->listener);
+          w->listener = nullptr;
+        }
     
 #ifndef WIN32
-    event_free (this->pipe_event);
+    if (this->pipe_event)
+      {
+        event_free (this->pipe_event);
+        this->pipe_event = nullptr;
+      }
 #endif
   }
   
@@ -694,6 +1017,12 @@ namespace hc {
       [&] (scheduler::task& task) { this->cleanup_conns (task); }).run (1000);
     this->sched.create (
       [&] (scheduler::task& task) { this->keep_alive (task); }).run (15000);
+    this->sched.create (
+      [&] (scheduler::task& task) { this->report_workers (task); }).run (60000);
+    this->sched.create (
+      [&] (scheduler::task& task) { this->cleanup_rate_limits (task); }).run (30000);
+    this->sched.create (
+      [&] (scheduler::task& task) { this->tick_worlds (task); }).run (50);
   }
   
   void
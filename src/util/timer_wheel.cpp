@@ -0,0 +1,200 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/timer_wheel.hpp"
+
+
+namespace hc {
+  
+  /* 
+   * Constructs a new timer wheel that advances in steps of the specified
+   * number of milliseconds.
+   */
+  timer_wheel::timer_wheel (int res)
+  {
+    this->res = (res < 1) ? 1 : res;
+    this->origin = std::chrono::steady_clock::now ();
+    this->now = 0;
+    this->count = 0;
+    for (int i = 0; i < TIMER_WHEEL_LEVELS; ++i)
+      for (int j = 0; j < TIMER_WHEEL_SLOTS; ++j)
+        this->slots[i][j] = nullptr;
+  }
+  
+  
+  
+  void
+  timer_wheel::insert (timer *t)
+  {
+    if (t->expires < this->now)
+      t->expires = this->now;
+    
+    // the timer goes into the lowest level that can hold its delay; its slot
+    // is determined by the bits of its expiry time that belong to that level.
+    unsigned long long delta = t->expires - this->now;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1
+      && delta >= (1ULL << ((level + 1) * TIMER_WHEEL_BITS)))
+      ++ level;
+    
+    unsigned long long max_delta = 1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS);
+    if (delta >= max_delta)
+      t->expires = this->now + max_delta - 1;
+    
+    int slot = (int)(t->expires >> (level * TIMER_WHEEL_BITS))
+      & (TIMER_WHEEL_SLOTS - 1);
+    timer *& head = this->slots[level][slot];
+    t->prev = nullptr;
+    t->next = head;
+    if (head)
+      head->prev = t;
+    head = t;
+    t->pending = true;
+  }
+  
+  void
+  timer_wheel::unlink (timer *t)
+  {
+    if (t->prev)
+      t->prev->next = t->next;
+    else
+      {
+        // the timer is at the head of its slot's list.
+        for (int i = 0; i < TIMER_WHEEL_LEVELS; ++i)
+          {
+            int slot = (int)(t->expires >> (i * TIMER_WHEEL_BITS))
+              & (TIMER_WHEEL_SLOTS - 1);
+            if (this->slots[i][slot] == t)
+              {
+                this->slots[i][slot] = t->next;
+                break;
+              }
+          }
+      }
+    
+    if (t->next)
+      t->next->prev = t->prev;
+    t->prev = t->next = nullptr;
+    t->pending = false;
+  }
+  
+  /* 
+   * Moves the timers held in the specified slot of a higher level down
+   * to the levels below it.
+   */
+  void
+  timer_wheel::cascade (int level, int slot)
+  {
+    timer *t = this->slots[level][slot];
+    this->slots[level][slot] = nullptr;
+    while (t)
+      {
+        timer *next = t->next;
+        this->insert (t);
+        t = next;
+      }
+  }
+  
+  
+  
+  /* 
+   * Arms the specified timer to fire after the given amount of
+   * milliseconds.  If the timer is already pending, it is rescheduled.
+   */
+  void
+  timer_wheel::schedule (timer *t, int ms)
+  {
+    std::lock_guard<std::mutex> guard { this->mtx };
+    if (t->pending)
+      this->unlink (t);
+    else
+      ++ this->count;
+    
+    if (ms < 0)
+      ms = 0;
+    t->expires = this->now + (ms + this->res - 1) / this->res;
+    this->insert (t);
+  }
+  
+  /* 
+   * Disarms the specified timer, if pending.
+   */
+  void
+  timer_wheel::cancel (timer *t)
+  {
+    std::lock_guard<std::mutex> guard { this->mtx };
+    if (t->pending)
+      {
+        this->unlink (t);
+        -- this->count;
+      }
+  }
+  
+  
+  
+  /* 
+   * Processes all ticks up to the current time, invoking the callbacks of
+   * any timers that expire.  Callbacks are called without the wheel being
+   * locked, and so they may freely schedule or cancel timers.
+   */
+  void
+  timer_wheel::advance ()
+  {
+    unsigned long long target = (unsigned long long)
+      std::chrono::duration_cast<std::chrono::milliseconds> (
+        std::chrono::steady_clock::now () - this->origin).count () / this->res;
+    
+    std::unique_lock<std::mutex> guard { this->mtx };
+    while (this->now <= target)
+      {
+        if (this->count == 0)
+          {
+            // nothing to do, skip ahead.
+            this->now = target + 1;
+            break;
+          }
+        
+        // refill the lower levels whenever they wrap around.
+        int slot = (int)(this->now & (TIMER_WHEEL_SLOTS - 1));
+        for (int level = 1; slot == 0 && level < TIMER_WHEEL_LEVELS; ++level)
+          {
+            slot = (int)(this->now >> (level * TIMER_WHEEL_BITS))
+              & (TIMER_WHEEL_SLOTS - 1);
+            this->cascade (level, slot);
+          }
+        
+        // timers are taken out one at a time, since a callback might cancel
+        // other timers in the same slot.
+        slot = (int)(this->now & (TIMER_WHEEL_SLOTS - 1));
+        while (this->slots[0][slot])
+          {
+            timer *t = this->slots[0][slot];
+            this->unlink (t);
+            -- this->count;
+            
+            guard.unlock ();
+            if (t->cb)
+              t->cb ();
+            guard.lock ();
+          }
+        
+        ++ this->now;
+      }
+  }
+}
+
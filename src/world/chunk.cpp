@@ -18,6 +18,7 @@
 
 #include "world/chunk.hpp"
 #include "world/blocks.hpp"
+#include "network/shared_packet.hpp"
 #include <cstring>
 #include <algorithm>
 
@@ -43,12 +44,19 @@ namespace hc {
     
     for (int i = 0; i < 4; ++i)
       this->neighbours[i] = nullptr;
+    
+    this->ver = 0;
+    this->cache_pack = nullptr;
+    this->cache_ver = 0;
   }
   
   chunk::~chunk ()
   {
     for (int i = 0; i < 16; ++i)
       delete this->subs[i];
+    
+    if (this->cache_pack)
+      this->cache_pack->release ();
   }
   
   
@@ -91,6 +99,10 @@ namespace hc {
       }
     else if (this->hmap[hind] == y + 1)
       this->recalc_height_at (x, z, y - 1);
+    
+    // bumped only once the block has been written, so that a packet built
+    // from the old contents is never cached under the new version.
+    this->ver.fetch_add (1, std::memory_order_release);
   }
   
   unsigned short
@@ -117,6 +129,8 @@ namespace hc {
     int index = ((y & 0xF) << 8) | (z << 4) | x;
     sub->types[index] &= 0xFFF0;
     sub->types[index] |= meta;
+    
+    this->ver.fetch_add (1, std::memory_order_release);
   }
   
   unsigned char
@@ -152,6 +166,8 @@ namespace hc {
         sub->sl[si] &= 0xF0;
         sub->sl[si] |= sl;
       }
+    
+    this->ver.fetch_add (1, std::memory_order_release);
   }
   
   unsigned char
@@ -189,6 +205,8 @@ namespace hc {
         sub->bl[si] &= 0xF0;
         sub->bl[si] |= bl;
       }
+    
+    this->ver.fetch_add (1, std::memory_order_release);
   }
   
   unsigned char
@@ -228,6 +246,74 @@ namespace hc {
       }
     else if (this->hmap[hind] == y + 1)
       this->recalc_height_at (x, z, y - 1);
+    
+    this->ver.fetch_add (1, std::memory_order_release);
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  /* 
+   * Returns a packet that contains the chunk's data for the specified
+   * protocol.  The packet is cached and shared between all players that
+   * see the chunk, and is only rebuilt (using the given function) once
+   * the chunk has been modified.
+   * The returned packet is grabbed on the caller's behalf.
+   */
+  shared_packet*
+  chunk::get_data_packet (const std::string& proto,
+    std::function<packet* ()>&& build)
+  {
+    std::lock_guard<std::mutex> guard { this->cache_mtx };
+    
+    unsigned int ver = this->ver.load (std::memory_order_acquire);
+    if (this->cache_pack && this->cache_ver == ver && this->cache_proto == proto)
+      return this->cache_pack->grab ();
+    
+    // NOTE: if the chunk gets modified while the packet is being built, the
+    //       version will have changed and the packet will be rebuilt the
+    //       next time around.
+    shared_packet *sp = shared_packet::create (build ());
+    if (this->cache_pack)
+      this->cache_pack->release ();
+    this->cache_pack = sp;
+    this->cache_ver = ver;
+    this->cache_proto = proto;
+    
+    return sp->grab ();
+  }
+  
+  
+  
+  /* 
+   * Records that the block at the specified position has been modified.
+   * Returns true if this is the first change since the journal was last
+   * taken, i.e. the chunk has to be queued for broadcasting.
+   */
+  bool
+  chunk::journal_change (int x, int y, int z)
+  {
+    std::lock_guard<std::mutex> guard { this->change_mtx };
+    this->changes.push_back ((unsigned short)((y << 8) | (z << 4) | x));
+    return this->changes.size () == 1;
+  }
+  
+  /* 
+   * Moves the positions recorded in the chunk's change journal into
+   * `out' (sorted, with no duplicates), and clears the journal.
+   */
+  void
+  chunk::take_changes (std::vector<unsigned short>& out)
+  {
+    out.clear ();
+    {
+      std::lock_guard<std::mutex> guard { this->change_mtx };
+      out.swap (this->changes);
+    }
+    
+    std::sort (out.begin (), out.end ());
+    out.erase (std::unique (out.begin (), out.end ()), out.end ());
   }
   
   
@@ -23,6 +23,11 @@
 #include "world/world_provider.hpp"
 #include "player/player.hpp"
 #include "system/server.hpp"
+#include "network/connection.hpp"
+#include "network/protocol.hpp"
+#include "network/packet.hpp"
+#include "network/shared_packet.hpp"
+#include "network/builders/mc18.hpp"
 #include <algorithm>
 #include <chrono>
 
@@ -31,7 +36,8 @@ namespace hc {
   
   world::world (const std::string& name, server& srv, world_generator *gen,
     world_provider *prov, int width, int depth)
-    : srv (srv), log (srv.get_logger ()), async_gen (*this, srv.get_gen_seq ())
+    : srv (srv), log (srv.get_logger ()), async_gen (*this, srv.get_gen_seq ()),
+      tracker (*this)
   {
     this->inf.name = name;
     this->inf.seed = std::chrono::duration_cast<std::chrono::nanoseconds> (
@@ -41,6 +47,7 @@ namespace hc {
     
     this->gen = gen;
     this->prov = prov;
+    this->persistent = true;
     this->inf.spawn_pos = this->gen->find_spawn ();
     this->inf.gen_name = this->gen->name ();
     
@@ -58,10 +65,11 @@ namespace hc {
   world::world (const world_data& wd, server& srv, world_generator *gen,
     world_provider *prov)
     : srv (srv), log (srv.get_logger ()), inf (wd),
-      async_gen (*this, srv.get_gen_seq ())
+      async_gen (*this, srv.get_gen_seq ()), tracker (*this)
   {
     this->gen = gen;
     this->prov = prov;
+    this->persistent = true;
     
     if (this->prov)
       {
@@ -298,6 +306,7 @@ namespace hc {
       }
     
     ch->set_id (x & 15, y, z & 15, id);
+    this->journal_change (ch, x, y, z);
     this->srv.get_lighting_manager ().enqueue (this, x, y, z);
   }
   
@@ -346,10 +355,155 @@ namespace hc {
       }
     
     ch->set_id_and_meta (x & 15, y, z & 15, id, meta);
+    this->journal_change (ch, x, y, z);
     this->srv.get_lighting_manager ().enqueue (this, x, y, z);
   }
   
   
+  void
+  world::journal_change (chunk *ch, int x, int y, int z)
+  {
+    if (ch == this->edge_ch)
+      return;
+    
+    if (ch->journal_change (x & 15, y, z & 15))
+      {
+        std::lock_guard<std::mutex> guard { this->change_mtx };
+        this->changed_chs.push_back (ch);
+      }
+  }
+  
+  
+  
+#define SECTION_RESEND_THRESHOLD  1024  // changes after which a whole section is resent
+  
+  namespace {
+    
+    /* 
+     * The packets that describe a chunk's batched changes, built for a
+     * particular protocol.
+     */
+    struct change_batch
+    {
+      std::string proto;
+      std::vector<shared_packet *> packs;
+      
+      void
+      clear ()
+      {
+        for (auto sp : this->packs)
+          sp->release ();
+        this->packs.clear ();
+      }
+    };
+  }
+  
+  /* 
+   * Sends the blocks modified since the last call to every player that can
+   * see them.  Changes are batched per chunk, so that a large edit costs
+   * a few packets per chunk rather than one per block.
+   * Called once per tick.
+   */
+  void
+  world::broadcast_changes ()
+  {
+    std::vector<chunk *> chs;
+    {
+      std::lock_guard<std::mutex> guard { this->change_mtx };
+      if (this->changed_chs.empty ())
+        return;
+      chs.swap (this->changed_chs);
+    }
+    
+    std::vector<unsigned short> changes;
+    change_batch batch;
+    for (chunk *ch : chs)
+      {
+        ch->take_changes (changes);
+        if (changes.empty ())
+          continue;
+        
+        // sections that have been changed wholesale are cheaper to resend in
+        // their entirety.
+        int counts[16] = { 0 };
+        for (unsigned short c : changes)
+          ++ counts[c >> 12];
+        unsigned short resend_mask = 0;
+        for (int i = 0; i < 16; ++i)
+          if (counts[i] >= SECTION_RESEND_THRESHOLD && ch->get_sub (i))
+            resend_mask |= 1 << i;
+        if (resend_mask)
+          changes.erase (std::remove_if (changes.begin (), changes.end (),
+            [resend_mask] (unsigned short c) {
+              return (resend_mask & (1 << (c >> 12))) != 0;
+            }), changes.end ());
+        
+        chunk_pos cp = ch->get_pos ();
+        batch.proto.clear ();
+        this->all_players (
+          [&] (player *pl) {
+            if (!pl->can_see_chunk (cp))
+              return;
+            
+            connection& conn = pl->get_connection ();
+            protocol *proto = conn.get_protocol ();
+            if (batch.proto != proto->get_name ())
+              {
+                // TODO: generalize
+                auto builder = dynamic_cast<mc18_packet_builder *> (
+                  proto->get_builder ());
+                if (!builder)
+                  return;
+                
+                batch.clear ();
+                batch.proto = proto->get_name ();
+                
+                // block changes travel in the same lane as chunk data, so
+                // that they cannot overtake the chunk they apply to.
+                packet *pack = nullptr;
+                if (changes.size () == 1)
+                  {
+                    int bx = changes[0] & 15, bz = (changes[0] >> 4) & 15;
+                    int by = changes[0] >> 8;
+                    pack = builder->make_block_change (
+                      (cp.x << 4) | bx, by, (cp.z << 4) | bz,
+                      ch->get_id (bx, by, bz), ch->get_meta (bx, by, bz));
+                  }
+                else if (!changes.empty ())
+                  pack = builder->make_multi_block_change (cp.x, cp.z,
+                    changes.data (), (int)changes.size (), ch);
+                if (pack)
+                  {
+                    pack->set_priority (PP_BULK);
+                    batch.packs.push_back (shared_packet::create (pack));
+                  }
+                
+                if (resend_mask)
+                  batch.packs.push_back (shared_packet::create (
+                    builder->make_chunk_data (cp.x, cp.z, false, resend_mask, ch)));
+              }
+            
+            for (auto sp : batch.packs)
+              conn.send (sp);
+          });
+        batch.clear ();
+      }
+  }
+  
+  /* 
+   * Broadcasts block changes, entity movement and player list updates made
+   * since the last tick.
+   * Called once per tick.
+   */
+  void
+  world::tick ()
+  {
+    this->broadcast_changes ();
+    this->tracker.tick ();
+    this->broadcast_list_changes ();
+  }
+  
+  
   
 //------------------------------------------------------------------------------
   
@@ -385,6 +539,105 @@ namespace hc {
       cb (pl);
   }
   
+  /* 
+   * Sends a packet to every player in the world.  The packet is built
+   * (and compressed) at most once per protocol, and shared between all
+   * connections.
+   */
+  void
+  world::broadcast (std::function<packet* (packet_builder *)>&& build)
+  {
+    protocol_packet pack (std::move (build));
+    
+    std::lock_guard<std::mutex> guard (this->pl_mtx);
+    for (player *pl : this->pls)
+      pack.send_to (pl->get_connection ());
+  }
+  
+  
+  
+  namespace {
+    
+    inline player_list_entry
+    _list_entry (player *pl)
+    {
+      return { pl->get_uuid (), pl->get_username (), pl->get_gm (),
+        pl->get_ping () };
+    }
+  }
+  
+  /* 
+   * Adds the specified player to the tab list of everyone in the world,
+   * and sends it the whole list in a single packet.
+   */
+  void
+  world::list_player (player *pl)
+  {
+    // one packet for everyone else, built once per protocol.
+    player_list_entry me = _list_entry (pl);
+    protocol_packet add (
+      [&me] (packet_builder *builder) {
+        return builder->make_player_list_add (&me, 1);
+      });
+    
+    std::vector<player_list_entry> entries;
+    this->all_players (
+      [&] (player *other) {
+        entries.push_back (_list_entry (other));
+        if (other != pl)
+          add.send_to (other->get_connection ());
+      });
+    
+    connection& conn = pl->get_connection ();
+    conn.send (conn.get_protocol ()->get_builder ()->make_player_list_add (
+      entries.data (), (int)entries.size ()));
+  }
+  
+  /* 
+   * Removes the specified player from the tab list of everyone in the
+   * world.
+   */
+  void
+  world::unlist_player (player *pl)
+  {
+    player_list_entry me = _list_entry (pl);
+    this->broadcast (
+      [&me] (packet_builder *builder) {
+        return builder->make_player_list_remove (&me, 1);
+      });
+  }
+  
+  /* 
+   * Sends everyone in the world the game mode and ping changes made since
+   * the last tick, coalesced into one packet per kind of change.
+   */
+  void
+  world::broadcast_list_changes ()
+  {
+    std::vector<player_list_entry> gms, pings;
+    this->all_players (
+      [&] (player *pl) {
+        int changes = pl->take_list_changes ();
+        if (changes & PLC_GAMEMODE)
+          gms.push_back (_list_entry (pl));
+        if (changes & PLC_PING)
+          pings.push_back (_list_entry (pl));
+      });
+    
+    if (!gms.empty ())
+      this->broadcast (
+        [&gms] (packet_builder *builder) {
+          return builder->make_player_list_update_gm (gms.data (),
+            (int)gms.size ());
+        });
+    if (!pings.empty ())
+      this->broadcast (
+        [&pings] (packet_builder *builder) {
+          return builder->make_player_list_update_ping (pings.data (),
+            (int)pings.size ());
+        });
+  }
+  
   
   
   /* 
@@ -393,7 +646,7 @@ namespace hc {
   void
   world::save_all ()
   {
-    if (!this->prov)
+    if (!this->prov || !this->persistent)
       return;
     
     std::lock_guard<std::mutex> guard (this->ch_mtx);
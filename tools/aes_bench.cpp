@@ -0,0 +1,179 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* 
+ * AES/CFB8 microbenchmark.
+ * 
+ * Compares the throughput of the StringSource/StreamTransformationFilter
+ * chain that was previously used to encrypt packets with the evbuffer-based
+ * aes_transformer, and with raw in-place ProcessData() calls.
+ * 
+ * Usage: aes-bench [total megabytes per run]
+ */
+
+#include "network/transformers/aes.hpp"
+#include <cryptopp/filters.h>
+#include <event2/buffer.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+using namespace hc;
+
+
+namespace {
+  
+  typedef std::chrono::steady_clock bench_clock;
+  
+  double
+  _elapsed (bench_clock::time_point start)
+  {
+    return std::chrono::duration<double> (bench_clock::now () - start).count ();
+  }
+  
+  void
+  _report (const char *name, int size, long long total, double secs)
+  {
+    std::cout << "  " << std::left << std::setw (14) << name
+              << std::right << std::setw (8) << size << " B  "
+              << std::fixed << std::setprecision (1) << std::setw (9)
+              << (total / secs / (1024.0 * 1024.0)) << " MB/s  "
+              << std::setw (9) << (secs * 1e9 / (total / size)) << " ns/packet"
+              << std::endl;
+  }
+  
+  
+  
+  /* 
+   * The old approach: copy into a string, run it through a filter chain,
+   * and copy the result into a new array.
+   */
+  double
+  _bench_filter (const unsigned char *key, const std::vector<unsigned char>& data,
+    int count)
+  {
+    CryptoPP::CFB_Mode<CryptoPP::AES>::Encryption enc (key, 16, key, 1);
+    
+    auto start = bench_clock::now ();
+    for (int i = 0; i < count; ++i)
+      {
+        std::string in_str ((const char *)data.data (), data.size ());
+        std::string out_str;
+        CryptoPP::StringSource (in_str, true,
+          new CryptoPP::StreamTransformationFilter (enc,
+            new CryptoPP::StringSink (out_str)));
+        
+        unsigned char *out = new unsigned char [data.size ()];
+        std::memcpy (out, out_str.c_str (), out_str.size ());
+        delete[] out;
+      }
+    
+    return _elapsed (start);
+  }
+  
+  /* 
+   * The evbuffer-based transformer, as used by connections.
+   */
+  double
+  _bench_transformer (const unsigned char *key,
+    const std::vector<unsigned char>& data, int count)
+  {
+    aes_transformer tr;
+    tr.setup (key);
+    tr.start ();
+    
+    struct evbuffer *in = evbuffer_new ();
+    struct evbuffer *out = evbuffer_new ();
+    
+    auto start = bench_clock::now ();
+    for (int i = 0; i < count; ++i)
+      {
+        evbuffer_add_reference (in, data.data (), data.size (), NULL, NULL);
+        tr.transform_out (in, out);
+        evbuffer_drain (out, evbuffer_get_length (out));
+      }
+    double secs = _elapsed (start);
+    
+    evbuffer_free (in);
+    evbuffer_free (out);
+    return secs;
+  }
+  
+  /* 
+   * Plain in-place ProcessData() calls, an upper bound for the above.
+   */
+  double
+  _bench_in_place (const unsigned char *key, std::vector<unsigned char> data,
+    int count)
+  {
+    CryptoPP::CFB_Mode<CryptoPP::AES>::Encryption enc (key, 16, key, 1);
+    
+    auto start = bench_clock::now ();
+    for (int i = 0; i < count; ++i)
+      enc.ProcessData (data.data (), data.data (), data.size ());
+    
+    return _elapsed (start);
+  }
+}
+
+
+
+int
+main (int argc, char *argv[])
+{
+  long long total = 64LL * 1024 * 1024;
+  if (argc > 1)
+    total = std::atoll (argv[1]) * 1024 * 1024;
+  if (total <= 0)
+    {
+      std::cerr << "usage: " << argv[0] << " [total megabytes per run]" << std::endl;
+      return 1;
+    }
+  
+  std::cout << "AES-NI: " << (aes_transformer::hardware_accelerated ()
+    ? "available" : "not available") << std::endl;
+  
+  unsigned char key[16];
+  for (int i = 0; i < 16; ++i)
+    key[i] = (unsigned char)(i * 31 + 7);
+  
+  static const int sizes[] = { 16, 64, 512, 4096, 65536 };
+  for (int size : sizes)
+    {
+      std::vector<unsigned char> data (size);
+      for (int i = 0; i < size; ++i)
+        data[i] = (unsigned char)(i * 13);
+      
+      int count = (int)(total / size);
+      if (count < 1)
+        count = 1;
+      long long bytes = (long long)count * size;
+      
+      std::cout << std::endl;
+      _report ("filter chain", size, bytes, _bench_filter (key, data, count));
+      _report ("transformer", size, bytes, _bench_transformer (key, data, count));
+      _report ("in-place", size, bytes, _bench_in_place (key, data, count));
+    }
+  
+  return 0;
+}
+
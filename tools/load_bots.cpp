@@ -0,0 +1,1229 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* 
+ * Headless bot client load generator (protocol #47, client version 1.8).
+ * 
+ * Opens a number of simulated clients against a server running in offline
+ * mode.  Every bot logs in (accepting encryption and compression if the
+ * server asks for them), walks a scripted path to make the server stream
+ * chunks, chats, and places and digs blocks.
+ * 
+ * At the end of the run, login latency, chunk delivery throughput, bytes
+ * per second and chat round-trip time percentiles are reported.
+ * 
+ * Bots connecting to a loopback address bind to distinct 127.x.y.z source
+ * addresses, so that the server's per-IP rate limits see them as different
+ * clients.
+ * 
+ * Usage: load-bots [options]  (see --help)
+ */
+
+#include "network/packet.hpp"
+#include "network/transformers/aes.hpp"
+#include "network/transformers/zlib_mc18.hpp"
+#include "util/binary.hpp"
+#include "util/common.hpp"
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <cryptopp/rsa.h>
+#include <cryptopp/osrng.h>
+#include <cryptopp/filters.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace hc;
+
+
+namespace {
+  
+  typedef std::chrono::steady_clock bot_clock;
+  
+  double
+  _ms_since (bot_clock::time_point start, bot_clock::time_point now)
+  {
+    return std::chrono::duration<double, std::milli> (now - start).count ();
+  }
+  
+  
+  
+  enum walk_path
+  {
+    WP_IDLE,    // stand at the spawn point
+    WP_CIRCLE,  // walk around the spawn point
+    WP_LINE,    // walk away from the spawn point, forever
+  };
+  
+  struct bot_options
+  {
+    std::string host = "127.0.0.1";
+    int port = 25565;
+    std::string prefix = "bot";
+    int count = 100;
+    int threads = 2;
+    double connect_rate = 50.0;   // connections per second
+    int duration = 60;            // seconds
+    int report_interval = 5;      // seconds
+    walk_path path = WP_CIRCLE;
+    double walk_radius = 48.0;    // blocks
+    double walk_speed = 4.3;      // blocks per second
+    double chat_interval = 15.0;  // seconds, 0 to disable
+    double build_interval = 5.0;  // seconds, 0 to disable
+    bool spread = true;           // distinct loopback source addresses
+  };
+  
+  /* 
+   * Counters that are updated by all worker threads.
+   */
+  struct bot_totals
+  {
+    std::atomic<long long> bytes_in { 0 };    // on the wire
+    std::atomic<long long> bytes_out { 0 };
+    std::atomic<long long> packets_in { 0 };  // decoded
+    std::atomic<long long> packets_out { 0 };
+    std::atomic<long long> chunks { 0 };
+    std::atomic<long long> chunk_bytes { 0 }; // uncompressed chunk data
+    std::atomic<long long> chats_sent { 0 };
+    std::atomic<long long> chats_lost { 0 };
+    std::atomic<int> connected { 0 };
+    std::atomic<int> logged_in { 0 };
+    std::atomic<int> spawned { 0 };
+    std::atomic<int> failed { 0 };
+    std::atomic<int> kicked { 0 };
+  };
+  
+  
+  
+  class bot_worker;
+  
+  enum bot_state
+  {
+    BS_IDLE,
+    BS_CONNECTING,
+    BS_LOGIN,
+    BS_PLAY,
+    BS_CLOSED,
+  };
+  
+  /* 
+   * A single simulated client.
+   */
+  class bot
+  {
+    bot_worker& w;
+    int index;
+    std::string name;
+    bot_state state;
+    struct bufferevent *bev;
+    
+    aes_transformer aes;
+    zlib_mc18_transformer zlib;
+    struct evbuffer *dbuf;  // decrypted data, waiting for decompression
+    struct evbuffer *fbuf;  // framed packets
+    struct evbuffer *sbuf;  // scratch space for outgoing packets
+    struct evbuffer *tbuf;
+    bool zlib_pending;
+    
+    bot_clock::time_point t_start;
+    bot_clock::time_point t_connect;
+    
+    // play state
+    bool spawned;
+    double x, y, z;
+    double spawn_x, spawn_z;
+    double heading;
+    double walked;
+    bot_clock::time_point t_last_move;
+    bot_clock::time_point t_next_chat;
+    bot_clock::time_point t_next_build;
+    int chat_seq;
+    bool chat_waiting;
+    bot_clock::time_point t_chat;
+    bool dig_pending;
+    int dig_x, dig_y, dig_z;
+  
+  public:
+    inline bot_state get_state () const { return this->state; }
+    inline bot_clock::time_point get_start_time () const { return this->t_start; }
+  
+  public:
+    bot (bot_worker& w, int index, bot_clock::time_point t_start);
+    ~bot ();
+  
+  public:
+    void connect ();
+    void close ();
+    
+    /* 
+     * Runs the bot's script.  Called every worker tick.
+     */
+    void tick (bot_clock::time_point now);
+  
+  private:
+    void send (packet& pack);
+    
+    void send_handshake ();
+    void send_login_start ();
+    void send_keep_alive (int id);
+    void send_chat (const std::string& msg);
+    void send_position ();
+    void send_position_and_look ();
+    void send_dig (int x, int y, int z);
+    void send_place (int x, int y, int z);
+    void send_creative_slot (int slot, short id, unsigned char count);
+  
+  private:
+    void handle (packet_reader& reader);
+    void handle_login (int opc, packet_reader& reader);
+    void handle_play (int opc, packet_reader& reader);
+    
+    void handle_encryption_request (packet_reader& reader);
+    void handle_chat (packet_reader& reader);
+    void enable_compression (int threshold);
+    void kicked (packet_reader& reader);
+  
+  private:
+    static void on_read (struct bufferevent *bev, void *ctx);
+    static void on_event (struct bufferevent *bev, short events, void *ctx);
+  };
+  
+  
+  
+  /* 
+   * Drives a share of the bots from a single event loop.
+   */
+  class bot_worker
+  {
+    friend class bot;
+    
+    const bot_options& opts;
+    bot_totals& totals;
+    const std::atomic<bool>& stop;
+    struct event_base *base;
+    struct event *tick_ev;
+    struct sockaddr_in addr;
+    std::vector<bot *> bots;
+    CryptoPP::AutoSeededRandomPool rng;
+    std::thread th;
+  
+  public:
+    // latency samples, in milliseconds.  only read once the worker has been
+    // joined.
+    std::vector<double> login_ms;
+    std::vector<double> spawn_ms;
+    std::vector<double> chat_ms;
+    std::string last_kick;
+  
+  public:
+    bot_worker (const bot_options& opts, bot_totals& totals,
+      const std::atomic<bool>& stop, const struct sockaddr_in& addr);
+    ~bot_worker ();
+  
+  public:
+    void add_bot (int index, bot_clock::time_point t_start);
+    
+    void start ();
+    void join ();
+  
+  private:
+    void run ();
+    static void on_tick (evutil_socket_t fd, short events, void *ctx);
+  };
+
+
+
+//------------------------------------------------------------------------------
+  
+  bot::bot (bot_worker& w, int index, bot_clock::time_point t_start)
+    : w (w), index (index), t_start (t_start)
+  {
+    std::ostringstream ss;
+    ss << w.opts.prefix << index;
+    this->name = ss.str ();
+    
+    this->state = BS_IDLE;
+    this->bev = nullptr;
+    this->dbuf = evbuffer_new ();
+    this->fbuf = evbuffer_new ();
+    this->sbuf = evbuffer_new ();
+    this->tbuf = evbuffer_new ();
+    this->zlib_pending = false;
+    
+    this->spawned = false;
+    this->x = this->y = this->z = 0.0;
+    this->spawn_x = this->spawn_z = 0.0;
+    this->heading = index * 2.39996323; // golden angle, spreads bots evenly
+    this->walked = 0.0;
+    this->chat_seq = 0;
+    this->chat_waiting = false;
+    this->dig_pending = false;
+    this->dig_x = this->dig_y = this->dig_z = 0;
+  }
+  
+  bot::~bot ()
+  {
+    this->close ();
+    evbuffer_free (this->dbuf);
+    evbuffer_free (this->fbuf);
+    evbuffer_free (this->sbuf);
+    evbuffer_free (this->tbuf);
+  }
+  
+  
+  
+  void
+  bot::connect ()
+  {
+    this->state = BS_CONNECTING;
+    this->t_connect = bot_clock::now ();
+    
+    evutil_socket_t fd = socket (AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+      { this->close (); return; }
+    evutil_make_socket_nonblocking (fd);
+    
+    if (this->w.opts.spread
+      && (ntohl (this->w.addr.sin_addr.s_addr) >> 24) == 127)
+      {
+        // 127.0.0.0/8 is all loopback, pick a distinct address per bot.
+        unsigned int n = (unsigned int)this->index;
+        struct sockaddr_in src;
+        std::memset (&src, 0, sizeof src);
+        src.sin_family = AF_INET;
+        src.sin_addr.s_addr = htonl ((127u << 24) | ((1 + n / 62500) << 16)
+          | ((n / 250 % 250) << 8) | (1 + n % 250));
+        if (bind (fd, (struct sockaddr *)&src, sizeof src) != 0)
+          { evutil_closesocket (fd); this->close (); return; }
+      }
+    
+    this->bev = bufferevent_socket_new (this->w.base, fd, BEV_OPT_CLOSE_ON_FREE);
+    bufferevent_setcb (this->bev, &bot::on_read, nullptr, &bot::on_event, this);
+    bufferevent_enable (this->bev, EV_READ | EV_WRITE);
+    if (bufferevent_socket_connect (this->bev,
+      (struct sockaddr *)&this->w.addr, sizeof this->w.addr) != 0)
+      this->close ();
+  }
+  
+  void
+  bot::close ()
+  {
+    if (this->state == BS_CLOSED)
+      return;
+    
+    if (this->state == BS_CONNECTING || this->state == BS_LOGIN)
+      ++ this->w.totals.failed;
+    if (this->state == BS_LOGIN || this->state == BS_PLAY)
+      -- this->w.totals.connected;
+    if (this->spawned)
+      -- this->w.totals.spawned;
+    if (this->state == BS_PLAY)
+      -- this->w.totals.logged_in;
+    
+    this->state = BS_CLOSED;
+    this->spawned = false;
+    if (this->bev)
+      {
+        bufferevent_free (this->bev);
+        this->bev = nullptr;
+      }
+  }
+  
+  
+  
+  void
+  bot::tick (bot_clock::time_point now)
+  {
+    if (this->state == BS_IDLE)
+      {
+        if (now >= this->t_start)
+          this->connect ();
+        return;
+      }
+    if (this->state != BS_PLAY || !this->spawned)
+      return;
+    
+    const bot_options& opts = this->w.opts;
+    
+    if (this->dig_pending)
+      {
+        // break the block placed during the previous tick
+        this->dig_pending = false;
+        this->send_dig (this->dig_x, this->dig_y, this->dig_z);
+      }
+    
+    // walk
+    double dt = std::chrono::duration<double> (now - this->t_last_move).count ();
+    this->t_last_move = now;
+    if (opts.path != WP_IDLE)
+      {
+        this->walked += dt * opts.walk_speed;
+        if (opts.path == WP_CIRCLE && opts.walk_radius > 0.0)
+          {
+            double a = this->heading + this->walked / opts.walk_radius;
+            this->x = this->spawn_x + std::cos (a) * opts.walk_radius;
+            this->z = this->spawn_z + std::sin (a) * opts.walk_radius;
+          }
+        else
+          {
+            this->x = this->spawn_x + std::cos (this->heading) * this->walked;
+            this->z = this->spawn_z + std::sin (this->heading) * this->walked;
+          }
+        
+        this->send_position ();
+      }
+    
+    // chat
+    if (opts.chat_interval > 0.0 && now >= this->t_next_chat)
+      {
+        if (this->chat_waiting)
+          ++ this->w.totals.chats_lost;
+        
+        std::ostringstream ss;
+        ss << "#rtt:" << this->name << ":" << ++ this->chat_seq;
+        this->send_chat (ss.str ());
+        this->chat_waiting = true;
+        this->t_chat = now;
+        this->t_next_chat = now + std::chrono::milliseconds (
+          (long long)(opts.chat_interval * 1000.0));
+      }
+    
+    // place a block next to the bot, and break it on the next tick
+    if (opts.build_interval > 0.0 && now >= this->t_next_build)
+      {
+        int bx = (int)std::floor (this->x) + 1;
+        int by = (int)std::floor (this->y);
+        int bz = (int)std::floor (this->z);
+        
+        this->send_place (bx, by - 1, bz);
+        this->dig_pending = true;
+        this->dig_x = bx;
+        this->dig_y = by;
+        this->dig_z = bz;
+        this->t_next_build = now + std::chrono::milliseconds (
+          (long long)(opts.build_interval * 1000.0));
+      }
+  }
+
+
+
+//------------------------------------------------------------------------------
+  // 
+  // Sending:
+  // 
+  
+  /* 
+   * Prepends the packet's length, and writes it out through the active
+   * transformers (compression first, then encryption).
+   */
+  void
+  bot::send (packet& pack)
+  {
+    if (!this->bev)
+      return;
+    
+    unsigned char a[5];
+    int vl = bin::write_varint (a, pack.get_length ());
+    pack.use_reserved (vl);
+    pack.put_bytes (a, vl);
+    
+    evbuffer_add (this->sbuf, pack.get_data (), pack.get_length ());
+    if (this->zlib.is_on ())
+      {
+        if (!this->zlib.transform_out (this->sbuf, this->tbuf))
+          { this->close (); return; }
+        evbuffer_add_buffer (this->sbuf, this->tbuf);
+      }
+    if (this->aes.is_on ())
+      {
+        if (!this->aes.transform_out (this->sbuf, this->tbuf))
+          { this->close (); return; }
+        evbuffer_add_buffer (this->sbuf, this->tbuf);
+      }
+    
+    this->w.totals.bytes_out += evbuffer_get_length (this->sbuf);
+    ++ this->w.totals.packets_out;
+    bufferevent_write_buffer (this->bev, this->sbuf);
+  }
+  
+  void
+  _put_pos (packet& pack, int x, int y, int z)
+  {
+    pack.put_long (((unsigned long long)(x & 0x3FFFFFF) << 38) |
+      ((unsigned long long)(y & 0xFFF) << 26) | (z & 0x3FFFFFF));
+  }
+  
+  
+  
+  void
+  bot::send_handshake ()
+  {
+    packet pack;
+    pack.put_varint (0x00); // opcode
+    pack.put_varint (47);   // protocol version
+    pack.put_string (this->w.opts.host);
+    pack.put_short ((unsigned short)this->w.opts.port);
+    pack.put_varint (2);    // next state: login
+    this->send (pack);
+  }
+  
+  void
+  bot::send_login_start ()
+  {
+    packet pack;
+    pack.put_varint (0x00); // opcode
+    pack.put_string (this->name);
+    this->send (pack);
+  }
+  
+  void
+  bot::send_keep_alive (int id)
+  {
+    packet pack;
+    pack.put_varint (0x00); // opcode
+    pack.put_varint (id);
+    this->send (pack);
+  }
+  
+  void
+  bot::send_chat (const std::string& msg)
+  {
+    packet pack;
+    pack.put_varint (0x01); // opcode
+    pack.put_string (msg);
+    this->send (pack);
+    ++ this->w.totals.chats_sent;
+  }
+  
+  void
+  bot::send_position ()
+  {
+    packet pack;
+    pack.put_varint (0x04); // opcode
+    pack.put_double (this->x);
+    pack.put_double (this->y);
+    pack.put_double (this->z);
+    pack.put_bool (true);   // on ground
+    this->send (pack);
+  }
+  
+  void
+  bot::send_position_and_look ()
+  {
+    packet pack;
+    pack.put_varint (0x06); // opcode
+    pack.put_double (this->x);
+    pack.put_double (this->y);
+    pack.put_double (this->z);
+    pack.put_float (0.0f);  // yaw
+    pack.put_float (0.0f);  // pitch
+    pack.put_bool (true);   // on ground
+    this->send (pack);
+  }
+  
+  void
+  bot::send_dig (int x, int y, int z)
+  {
+    packet pack;
+    pack.put_varint (0x07); // opcode
+    pack.put_byte (DIG_START);
+    _put_pos (pack, x, y, z);
+    pack.put_byte (BFACE_Y_POS);
+    this->send (pack);
+  }
+  
+  void
+  bot::send_place (int x, int y, int z)
+  {
+    packet pack;
+    pack.put_varint (0x08); // opcode
+    _put_pos (pack, x, y, z);
+    pack.put_byte (BFACE_Y_POS);
+    pack.put_short (1);     // held item: stone
+    pack.put_byte (1);
+    pack.put_short (0);
+    pack.put_byte (0);      // no NBT data
+    pack.put_byte (8);      // cursor position
+    pack.put_byte (16);
+    pack.put_byte (8);
+    this->send (pack);
+  }
+  
+  void
+  bot::send_creative_slot (int slot, short id, unsigned char count)
+  {
+    packet pack;
+    pack.put_varint (0x10); // opcode
+    pack.put_short ((unsigned short)slot);
+    pack.put_short ((unsigned short)id);
+    pack.put_byte (count);
+    pack.put_short (0);     // damage
+    pack.put_byte (0);      // no NBT data
+    this->send (pack);
+  }
+
+
+
+//------------------------------------------------------------------------------
+  // 
+  // Receiving:
+  // 
+  
+  void
+  bot::on_read (struct bufferevent *bev, void *ctx)
+  {
+    bot *b = static_cast<bot *> (ctx);
+    bot_totals& totals = b->w.totals;
+    
+    struct evbuffer *input = bufferevent_get_input (bev);
+    totals.bytes_in += evbuffer_get_length (input);
+    
+    // decrypt, then decompress
+    struct evbuffer *next = b->zlib.is_on () ? b->dbuf : b->fbuf;
+    if (b->aes.is_on ())
+      {
+        if (!b->aes.transform_in (input, next))
+          { b->close (); return; }
+      }
+    else
+      evbuffer_add_buffer (next, input);
+    if (b->zlib.is_on () && !b->zlib.transform_in (b->dbuf, b->fbuf))
+      { b->close (); return; }
+    
+    packet_reader reader;
+    while (b->state == BS_LOGIN || b->state == BS_PLAY)
+      {
+        int len = (int)evbuffer_get_length (b->fbuf);
+        if (len <= 0)
+          break;
+        
+        unsigned char hdr[5];
+        int hlen = (int)evbuffer_copyout (b->fbuf, hdr, sizeof hdr);
+        int got = bin::got_varint (hdr, hlen);
+        if (got == 0)
+          break;
+        else if (got < 0)
+          { b->close (); return; }
+        
+        int vl;
+        int size = bin::read_varint (hdr, &vl) + vl;
+        if (size > len)
+          break;
+        
+        reader.reset (evbuffer_pullup (b->fbuf, size), size);
+        ++ totals.packets_in;
+        b->handle (reader);
+        if (b->state == BS_CLOSED)
+          return;
+        evbuffer_drain (b->fbuf, size);
+        
+        if (b->zlib_pending)
+          {
+            // everything after the Set Compression packet is compressed.
+            b->zlib_pending = false;
+            evbuffer_add_buffer (b->dbuf, b->fbuf);
+            if (!b->zlib.transform_in (b->dbuf, b->fbuf))
+              { b->close (); return; }
+          }
+      }
+  }
+  
+  void
+  bot::on_event (struct bufferevent *bev, short events, void *ctx)
+  {
+    bot *b = static_cast<bot *> (ctx);
+    
+    if (events & BEV_EVENT_CONNECTED)
+      {
+        evutil_socket_t fd = bufferevent_getfd (bev);
+        int one = 1;
+        setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof one);
+        
+        b->state = BS_LOGIN;
+        ++ b->w.totals.connected;
+        b->send_handshake ();
+        b->send_login_start ();
+      }
+    else if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+      b->close ();
+  }
+  
+  
+  
+  void
+  bot::handle (packet_reader& reader)
+  {
+    reader.read_varint (); // length
+    int opc = reader.read_varint ();
+    
+    if (this->state == BS_LOGIN)
+      this->handle_login (opc, reader);
+    else
+      this->handle_play (opc, reader);
+  }
+  
+  void
+  bot::handle_login (int opc, packet_reader& reader)
+  {
+    switch (opc)
+      {
+      case 0x00: // Disconnect
+        this->kicked (reader);
+        break;
+      
+      case 0x01: // Encryption Request
+        this->handle_encryption_request (reader);
+        break;
+      
+      case 0x02: // Login Success
+        {
+          auto now = bot_clock::now ();
+          this->w.login_ms.push_back (_ms_since (this->t_connect, now));
+          this->state = BS_PLAY;
+          ++ this->w.totals.logged_in;
+        }
+        break;
+      
+      case 0x03: // Set Compression
+        this->enable_compression (reader.read_varint ());
+        break;
+      }
+  }
+  
+  void
+  bot::handle_play (int opc, packet_reader& reader)
+  {
+    switch (opc)
+      {
+      case 0x00: // Keep Alive
+        this->send_keep_alive (reader.read_varint ());
+        break;
+      
+      case 0x02: // Chat Message
+        this->handle_chat (reader);
+        break;
+      
+      case 0x08: // Player Position And Look
+        {
+          this->x = reader.read_double ();
+          this->y = reader.read_double ();
+          this->z = reader.read_double ();
+          this->send_position_and_look ();
+          
+          auto now = bot_clock::now ();
+          if (!this->spawned)
+            {
+              this->spawned = true;
+              ++ this->w.totals.spawned;
+              this->w.spawn_ms.push_back (_ms_since (this->t_connect, now));
+              
+              const bot_options& opts = this->w.opts;
+              auto delay = [this, &opts] (double secs) {
+                  return std::chrono::milliseconds (
+                    (long long)(secs * 1000.0 * ((this->index % 100) + 1) / 100));
+                };
+              this->t_next_chat = now + delay (opts.chat_interval);
+              this->t_next_build = now + delay (opts.build_interval);
+              
+              // something to place
+              this->send_creative_slot (36, 1, 64);
+            }
+          
+          // scripted paths start over wherever the server puts the bot
+          this->spawn_x = this->x;
+          this->spawn_z = this->z;
+          this->walked = 0.0;
+          this->t_last_move = now;
+        }
+        break;
+      
+      case 0x21: // Chunk Data
+        {
+          reader.read_int ();   // x
+          reader.read_int ();   // z
+          reader.read_bool ();  // ground-up continuous
+          unsigned short mask = reader.read_short ();
+          int size = reader.read_varint ();
+          if (mask != 0 || size > 0)
+            {
+              ++ this->w.totals.chunks;
+              this->w.totals.chunk_bytes += size;
+            }
+        }
+        break;
+      
+      case 0x26: // Map Chunk Bulk
+        {
+          reader.read_bool ();  // sky light sent
+          int count = reader.read_varint ();
+          this->w.totals.chunks += count;
+          this->w.totals.chunk_bytes += reader.length () - reader.get_pos ()
+            - count * 10;
+        }
+        break;
+      
+      case 0x40: // Disconnect
+        this->kicked (reader);
+        break;
+      
+      case 0x46: // Set Compression
+        this->enable_compression (reader.read_varint ());
+        break;
+      }
+  }
+  
+  
+  
+  void
+  bot::handle_encryption_request (packet_reader& reader)
+  {
+    int sid_len = reader.read_varint ();
+    std::vector<unsigned char> sid (sid_len);
+    reader.read_bytes (sid.data (), sid_len);
+    
+    int key_len = reader.read_varint ();
+    if (key_len <= 0 || key_len > 1024)
+      { this->close (); return; }
+    std::vector<unsigned char> key (key_len);
+    reader.read_bytes (key.data (), key_len);
+    
+    int vtoken_len = reader.read_varint ();
+    if (vtoken_len <= 0 || vtoken_len > 64)
+      { this->close (); return; }
+    std::vector<unsigned char> vtoken (vtoken_len);
+    reader.read_bytes (vtoken.data (), vtoken_len);
+    
+    unsigned char ssec[16];
+    std::vector<unsigned char> ss_enc, vtoken_enc;
+    try
+      {
+        CryptoPP::AutoSeededRandomPool& rng = this->w.rng;
+        rng.GenerateBlock (ssec, sizeof ssec);
+        
+        CryptoPP::RSA::PublicKey pkey;
+        CryptoPP::ArraySource src (key.data (), key.size (), true);
+        pkey.Load (src);
+        
+        CryptoPP::RSAES_PKCS1v15_Encryptor enc (pkey);
+        ss_enc.resize (enc.CiphertextLength (sizeof ssec));
+        enc.Encrypt (rng, ssec, sizeof ssec, ss_enc.data ());
+        vtoken_enc.resize (enc.CiphertextLength (vtoken.size ()));
+        enc.Encrypt (rng, vtoken.data (), vtoken.size (), vtoken_enc.data ());
+      }
+    catch (const CryptoPP::Exception&)
+      {
+        this->close ();
+        return;
+      }
+    
+    packet pack;
+    pack.put_varint (0x01); // opcode
+    pack.put_varint ((int)ss_enc.size ());
+    pack.put_bytes (ss_enc.data (), (unsigned int)ss_enc.size ());
+    pack.put_varint ((int)vtoken_enc.size ());
+    pack.put_bytes (vtoken_enc.data (), (unsigned int)vtoken_enc.size ());
+    this->send (pack);
+    
+    // everything that follows is encrypted, in both directions.
+    this->aes.setup (ssec);
+    this->aes.start ();
+  }
+  
+  void
+  bot::handle_chat (packet_reader& reader)
+  {
+    if (!this->chat_waiting)
+      return;
+    
+    // look for our own marker (bot names never need escaping)
+    int len = reader.read_varint ();
+    std::string js (len, '\0');
+    reader.read_bytes ((unsigned char *)&js[0], len);
+    
+    std::ostringstream ss;
+    ss << "#rtt:" << this->name << ":" << this->chat_seq;
+    std::string marker = ss.str ();
+    
+    size_t p = js.find (marker);
+    if (p == std::string::npos)
+      return;
+    char after = js[p + marker.size ()];
+    if (after >= '0' && after <= '9')
+      return; // a longer sequence number
+    
+    this->chat_waiting = false;
+    this->w.chat_ms.push_back (_ms_since (this->t_chat, bot_clock::now ()));
+  }
+  
+  void
+  bot::enable_compression (int threshold)
+  {
+    if (threshold < 0 || this->zlib.is_on ())
+      return;
+    
+    this->zlib.setup (threshold, 1);
+    this->zlib.start ();
+    this->zlib_pending = true;
+  }
+  
+  void
+  bot::kicked (packet_reader& reader)
+  {
+    int len = reader.read_varint ();
+    std::string msg (len, '\0');
+    reader.read_bytes ((unsigned char *)&msg[0], len);
+    
+    this->w.last_kick = msg;
+    ++ this->w.totals.kicked;
+    this->close ();
+  }
+
+
+
+//------------------------------------------------------------------------------
+  
+  bot_worker::bot_worker (const bot_options& opts, bot_totals& totals,
+    const std::atomic<bool>& stop, const struct sockaddr_in& addr)
+    : opts (opts), totals (totals), stop (stop), addr (addr)
+  {
+    this->base = event_base_new ();
+    this->tick_ev = event_new (this->base, -1, EV_PERSIST,
+      &bot_worker::on_tick, this);
+  }
+  
+  bot_worker::~bot_worker ()
+  {
+    for (bot *b : this->bots)
+      delete b;
+    event_free (this->tick_ev);
+    event_base_free (this->base);
+  }
+  
+  
+  
+  void
+  bot_worker::add_bot (int index, bot_clock::time_point t_start)
+  {
+    this->bots.push_back (new bot (*this, index, t_start));
+  }
+  
+  void
+  bot_worker::start ()
+  {
+    this->th = std::thread ([this] { this->run (); });
+  }
+  
+  void
+  bot_worker::join ()
+  {
+    if (this->th.joinable ())
+      this->th.join ();
+  }
+
+
+
+#define BOT_TICK_INTERVAL   50 // milliseconds
+  
+  void
+  bot_worker::run ()
+  {
+    struct timeval tv = { 0, BOT_TICK_INTERVAL * 1000 };
+    event_add (this->tick_ev, &tv);
+    event_base_dispatch (this->base);
+  }
+  
+  void
+  bot_worker::on_tick (evutil_socket_t fd, short events, void *ctx)
+  {
+    bot_worker *w = static_cast<bot_worker *> (ctx);
+    
+    if (w->stop.load ())
+      {
+        for (bot *b : w->bots)
+          b->close ();
+        event_base_loopbreak (w->base);
+        return;
+      }
+    
+    auto now = bot_clock::now ();
+    for (bot *b : w->bots)
+      b->tick (now);
+  }
+
+
+
+//------------------------------------------------------------------------------
+  
+  void
+  _print_usage (const char *prog)
+  {
+    bot_options d;
+    std::cout << "usage: " << prog << " [options]\n"
+      << "  -H, --host ADDR         server address (default: " << d.host << ")\n"
+      << "  -p, --port PORT         server port (default: " << d.port << ")\n"
+      << "  -n, --bots N            number of bots (default: " << d.count << ")\n"
+      << "  -t, --threads N         worker threads (default: " << d.threads << ")\n"
+      << "  -r, --rate N            connections per second (default: " << d.connect_rate << ")\n"
+      << "  -d, --duration SECS     length of the run (default: " << d.duration << ")\n"
+      << "  -i, --interval SECS     progress report interval (default: " << d.report_interval << ")\n"
+      << "  -w, --walk PATH         idle, circle or line (default: circle)\n"
+      << "      --radius BLOCKS     radius of circular paths (default: " << d.walk_radius << ")\n"
+      << "      --speed BLOCKS      walking speed per second (default: " << d.walk_speed << ")\n"
+      << "  -c, --chat SECS         chat interval, 0 to disable (default: " << d.chat_interval << ")\n"
+      << "  -b, --build SECS        place/dig interval, 0 to disable (default: " << d.build_interval << ")\n"
+      << "      --prefix NAME       bot name prefix (default: " << d.prefix << ")\n"
+      << "      --no-spread         connect every bot from the same source address\n";
+  }
+  
+  bool
+  _parse_options (int argc, char *argv[], bot_options& opts)
+  {
+    enum { OPT_RADIUS = 256, OPT_SPEED, OPT_PREFIX, OPT_NO_SPREAD };
+    static const struct option long_opts[] = {
+      { "host",      required_argument, nullptr, 'H' },
+      { "port",      required_argument, nullptr, 'p' },
+      { "bots",      required_argument, nullptr, 'n' },
+      { "threads",   required_argument, nullptr, 't' },
+      { "rate",      required_argument, nullptr, 'r' },
+      { "duration",  required_argument, nullptr, 'd' },
+      { "interval",  required_argument, nullptr, 'i' },
+      { "walk",      required_argument, nullptr, 'w' },
+      { "radius",    required_argument, nullptr, OPT_RADIUS },
+      { "speed",     required_argument, nullptr, OPT_SPEED },
+      { "chat",      required_argument, nullptr, 'c' },
+      { "build",     required_argument, nullptr, 'b' },
+      { "prefix",    required_argument, nullptr, OPT_PREFIX },
+      { "no-spread", no_argument,       nullptr, OPT_NO_SPREAD },
+      { "help",      no_argument,       nullptr, 'h' },
+      { nullptr, 0, nullptr, 0 },
+    };
+    
+    int c;
+    while ((c = getopt_long (argc, argv, "H:p:n:t:r:d:i:w:c:b:h", long_opts,
+      nullptr)) != -1)
+      {
+        switch (c)
+          {
+          case 'H': opts.host = optarg; break;
+          case 'p': opts.port = std::atoi (optarg); break;
+          case 'n': opts.count = std::atoi (optarg); break;
+          case 't': opts.threads = std::atoi (optarg); break;
+          case 'r': opts.connect_rate = std::atof (optarg); break;
+          case 'd': opts.duration = std::atoi (optarg); break;
+          case 'i': opts.report_interval = std::atoi (optarg); break;
+          case 'c': opts.chat_interval = std::atof (optarg); break;
+          case 'b': opts.build_interval = std::atof (optarg); break;
+          case OPT_RADIUS: opts.walk_radius = std::atof (optarg); break;
+          case OPT_SPEED: opts.walk_speed = std::atof (optarg); break;
+          case OPT_PREFIX: opts.prefix = optarg; break;
+          case OPT_NO_SPREAD: opts.spread = false; break;
+          
+          case 'w':
+            if (std::strcmp (optarg, "idle") == 0)
+              opts.path = WP_IDLE;
+            else if (std::strcmp (optarg, "circle") == 0)
+              opts.path = WP_CIRCLE;
+            else if (std::strcmp (optarg, "line") == 0)
+              opts.path = WP_LINE;
+            else
+              return false;
+            break;
+          
+          default:
+            return false;
+          }
+      }
+    
+    // names are at most 16 characters long
+    int digits = (int)std::to_string (opts.count).size ();
+    return optind == argc && opts.port > 0 && opts.port < 65536
+      && opts.count > 0 && opts.threads > 0 && opts.connect_rate > 0.0
+      && opts.duration > 0 && opts.report_interval > 0
+      && (int)opts.prefix.size () + digits <= 16;
+  }
+  
+  bool
+  _resolve (const bot_options& opts, struct sockaddr_in& addr)
+  {
+    struct addrinfo hints, *res;
+    std::memset (&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo (opts.host.c_str (), nullptr, &hints, &res) != 0)
+      return false;
+    
+    std::memcpy (&addr, res->ai_addr, sizeof addr);
+    addr.sin_port = htons ((unsigned short)opts.port);
+    freeaddrinfo (res);
+    return true;
+  }
+  
+  
+  
+  void
+  _report_latency (const char *name, std::vector<double>& samples)
+  {
+    std::cout << "  " << std::left << std::setw (12) << name << std::right;
+    if (samples.empty ())
+      {
+        std::cout << "no samples" << std::endl;
+        return;
+      }
+    
+    std::sort (samples.begin (), samples.end ());
+    auto pct = [&samples] (double p) {
+        size_t i = (size_t)(p * (samples.size () - 1) + 0.5);
+        return samples[i];
+      };
+    
+    std::cout << std::fixed << std::setprecision (1)
+              << "p50 " << std::setw (8) << pct (0.50) << " ms  "
+              << "p90 " << std::setw (8) << pct (0.90) << " ms  "
+              << "p99 " << std::setw (8) << pct (0.99) << " ms  "
+              << "max " << std::setw (8) << samples.back () << " ms  "
+              << "(" << samples.size () << " samples)" << std::endl;
+  }
+}
+
+
+
+int
+main (int argc, char *argv[])
+{
+  bot_options opts;
+  if (!_parse_options (argc, argv, opts))
+    {
+      _print_usage (argv[0]);
+      return 1;
+    }
+  
+  struct sockaddr_in addr;
+  if (!_resolve (opts, addr))
+    {
+      std::cerr << "could not resolve `" << opts.host << "'" << std::endl;
+      return 1;
+    }
+  
+  bot_totals totals;
+  std::atomic<bool> stop { false };
+  
+  // bots are handed out to the workers round-robin, and connect at the
+  // requested rate.
+  std::vector<bot_worker *> workers;
+  for (int i = 0; i < opts.threads; ++i)
+    workers.push_back (new bot_worker (opts, totals, stop, addr));
+  
+  auto start = bot_clock::now ();
+  for (int i = 0; i < opts.count; ++i)
+    workers[i % opts.threads]->add_bot (i, start + std::chrono::microseconds (
+      (long long)(i * 1e6 / opts.connect_rate)));
+  
+  std::cout << "Running " << opts.count << " bots against " << opts.host
+    << ":" << opts.port << " for " << opts.duration << "s ("
+    << opts.threads << " threads)" << std::endl;
+  for (bot_worker *w : workers)
+    w->start ();
+  
+  long long last_in = 0, last_out = 0, last_chunks = 0;
+  auto last = start;
+  auto end = start + std::chrono::seconds (opts.duration);
+  while (bot_clock::now () < end)
+    {
+      auto next = std::min (end, last + std::chrono::seconds (opts.report_interval));
+      std::this_thread::sleep_until (next);
+      
+      auto now = bot_clock::now ();
+      double secs = std::chrono::duration<double> (now - last).count ();
+      long long in = totals.bytes_in, out = totals.bytes_out;
+      long long chunks = totals.chunks;
+      
+      std::cout << std::fixed << std::setprecision (1)
+        << "[" << std::setw (6) << std::chrono::duration<double> (now - start).count ()
+        << "s] connected " << totals.connected
+        << "  spawned " << totals.spawned
+        << "  chunks/s " << ((chunks - last_chunks) / secs)
+        << "  in " << ((in - last_in) / secs / (1024.0 * 1024.0)) << " MB/s"
+        << "  out " << ((out - last_out) / secs / 1024.0) << " KB/s"
+        << std::endl;
+      
+      last = now;
+      last_in = in;
+      last_out = out;
+      last_chunks = chunks;
+    }
+  
+  stop = true;
+  for (bot_worker *w : workers)
+    w->join ();
+  double secs = std::chrono::duration<double> (bot_clock::now () - start).count ();
+  
+  std::vector<double> login_ms, spawn_ms, chat_ms;
+  std::string last_kick;
+  for (bot_worker *w : workers)
+    {
+      login_ms.insert (login_ms.end (), w->login_ms.begin (), w->login_ms.end ());
+      spawn_ms.insert (spawn_ms.end (), w->spawn_ms.begin (), w->spawn_ms.end ());
+      chat_ms.insert (chat_ms.end (), w->chat_ms.begin (), w->chat_ms.end ());
+      if (!w->last_kick.empty ())
+        last_kick = w->last_kick;
+      delete w;
+    }
+  
+  std::cout << std::endl << "Summary (" << std::fixed << std::setprecision (1)
+    << secs << "s):" << std::endl;
+  std::cout << "  bots        " << opts.count << " started, "
+    << login_ms.size () << " logged in, " << spawn_ms.size () << " spawned, "
+    << totals.failed << " failed, " << totals.kicked << " kicked" << std::endl;
+  if (!last_kick.empty ())
+    std::cout << "  last kick   " << last_kick << std::endl;
+  std::cout << "  chunks      " << totals.chunks << " ("
+    << (totals.chunks / secs) << "/s, "
+    << (totals.chunk_bytes / secs / (1024.0 * 1024.0)) << " MB/s uncompressed)"
+    << std::endl;
+  std::cout << "  in          " << (totals.bytes_in / secs / (1024.0 * 1024.0))
+    << " MB/s, " << (long long)(totals.packets_in / secs) << " packets/s" << std::endl;
+  std::cout << "  out         " << (totals.bytes_out / secs / 1024.0)
+    << " KB/s, " << (long long)(totals.packets_out / secs) << " packets/s" << std::endl;
+  std::cout << "  chat        " << totals.chats_sent << " sent, "
+    << totals.chats_lost << " unanswered" << std::endl;
+  
+  std::cout << std::endl << "Latency:" << std::endl;
+  _report_latency ("login", login_ms);
+  _report_latency ("spawn", spawn_ms);
+  _report_latency ("chat rtt", chat_ms);
+  
+  return 0;
+}
@@ -0,0 +1,455 @@
+/*
+ * hCraft 2 - A revised custom Minecraft server.
+ * Copyright (C) 2015 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* 
+ * Capture replayer.
+ * 
+ * Feeds the packets recorded in one or more capture files (see
+ * `net.capture' in config.json) straight into the packet handlers of a
+ * server that runs offline, with no sockets involved.  Sessions are laid
+ * out on a single timeline according to their recorded start times, and
+ * connections are ticked every 20ms of timeline time.
+ * 
+ * The server is started from the current directory, so a copy of the
+ * world snapshot the captures were taken against should be placed there.
+ * Worlds are never saved during a replay, so the snapshot stays fixed
+ * between runs.
+ * 
+ * At the end of the run, the time spent in the handlers (per packet type)
+ * and the number of bytes the server would have sent are reported.
+ * 
+ * Usage: packet-replay [options] <capture files...>  (see --help)
+ */
+
+#include "network/capture.hpp"
+#include "network/connection.hpp"
+#include "network/packet.hpp"
+#include "network/packet_handler.hpp"
+#include "network/protocol.hpp"
+#include "system/logger.hpp"
+#include "system/server.hpp"
+#include "util/binary.hpp"
+#include "util/thread.hpp"
+#include <event2/thread.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+using namespace hc;
+
+
+namespace {
+  
+  typedef std::chrono::steady_clock replay_clock;
+
+#define REPLAY_TICK_INTERVAL    20000   // in microseconds
+  
+  struct replay_options
+  {
+    double speed = 1.0;   // relative to the recorded speed
+    bool fast = false;    // ignore recorded timing altogether
+    int linger = 1000;    // milliseconds to keep sessions open at their end
+    std::vector<std::string> files;
+  };
+  
+  struct session
+  {
+    std::string path;
+    std::string ip;
+    unsigned char flags;
+    long long start;      // microseconds, relative to the earliest session
+    std::vector<capture_reader::record> recs;
+    
+    connection *conn = nullptr;
+    bool done = false;
+    long long sunk = 0;
+  };
+  
+  struct replay_event
+  {
+    long long time;       // microseconds on the timeline
+    int sess;
+    int rec;              // -1 to end the session
+    
+    bool operator< (const replay_event& other) const
+      { return this->time < other.time; }
+  };
+  
+  struct opcode_stats
+  {
+    long long count = 0;
+    long long bytes = 0;
+    double secs = 0.0;
+  };
+
+
+
+//------------------------------------------------------------------------------
+  
+  /* 
+   * Loads the specified capture files.
+   * Sessions that fail to load are skipped.
+   */
+  void
+  _load_sessions (const replay_options& opts, std::vector<session>& sessions)
+  {
+    long long first = -1;
+    std::vector<long long> starts;
+    for (auto& path : opts.files)
+      {
+        capture_reader reader;
+        if (!reader.open (path))
+          {
+            std::cerr << "packet-replay: `" << path << "' is not a capture file" << std::endl;
+            continue;
+          }
+        
+        session s;
+        s.path = path;
+        s.ip = reader.get_ip ();
+        s.flags = reader.get_flags ();
+        
+        capture_reader::record rec;
+        while (reader.next (rec))
+          s.recs.push_back (std::move (rec));
+        if (s.recs.empty ())
+          continue;
+        
+        long long start = reader.get_start_time ();
+        if (first < 0 || start < first)
+          first = start;
+        starts.push_back (start);
+        sessions.push_back (std::move (s));
+      }
+    
+    for (size_t i = 0; i < sessions.size (); ++i)
+      sessions[i].start = (starts[i] - first) * 1000;
+  }
+  
+  /* 
+   * Lays every record of every session out on a single timeline.
+   */
+  void
+  _build_timeline (const replay_options& opts, std::vector<session>& sessions,
+    std::vector<replay_event>& events)
+  {
+    for (int i = 0; i < (int)sessions.size (); ++i)
+      {
+        session& s = sessions[i];
+        for (int j = 0; j < (int)s.recs.size (); ++j)
+          events.push_back ({ s.start + s.recs[j].time, i, j });
+        events.push_back ({ s.start + s.recs.back ().time
+          + (long long)opts.linger * 1000, i, -1 });
+      }
+    
+    std::stable_sort (events.begin (), events.end ());
+  }
+
+
+
+//------------------------------------------------------------------------------
+  
+  class replayer
+  {
+    server& srv;
+    const replay_options& opts;
+    std::vector<session>& sessions;
+    
+    std::vector<connection *> active;
+    std::map<std::string, opcode_stats> stats;
+    long long packets = 0;
+    long long skipped = 0;
+    double handler_secs = 0.0;
+  
+  public:
+    inline long long get_packets () const { return this->packets; }
+    inline double get_handler_secs () const { return this->handler_secs; }
+  
+  public:
+    replayer (server& srv, const replay_options& opts,
+      std::vector<session>& sessions)
+      : srv (srv), opts (opts), sessions (sessions)
+      { }
+  
+  public:
+    void run (const std::vector<replay_event>& events);
+    void report (double wall_secs);
+  
+  private:
+    void open_session (session& s);
+    void close_session (session& s);
+    void feed (session& s, const capture_reader::record& rec);
+    void tick ();
+  };
+  
+  
+  
+  void
+  replayer::run (const std::vector<replay_event>& events)
+  {
+    auto wall_start = replay_clock::now ();
+    long long next_tick = REPLAY_TICK_INTERVAL;
+    
+    for (auto& ev : events)
+      {
+        for (; next_tick <= ev.time; next_tick += REPLAY_TICK_INTERVAL)
+          {
+            if (!this->opts.fast)
+              std::this_thread::sleep_until (wall_start
+                + std::chrono::microseconds ((long long)(next_tick / this->opts.speed)));
+            this->tick ();
+          }
+        
+        if (!this->opts.fast)
+          std::this_thread::sleep_until (wall_start
+            + std::chrono::microseconds ((long long)(ev.time / this->opts.speed)));
+        
+        session& s = this->sessions[ev.sess];
+        if (ev.rec < 0)
+          this->close_session (s);
+        else
+          {
+            if (!s.conn && !s.done)
+              this->open_session (s);
+            if (s.conn)
+              this->feed (s, s.recs[ev.rec]);
+          }
+      }
+  }
+  
+  void
+  replayer::open_session (session& s)
+  {
+    connection *conn = new connection (this->srv, -1, s.ip.c_str ());
+    conn->infer_protocol ();
+    conn->start_detached ();
+    
+    // keep the connection around until the end of the session, even if the
+    // server disconnects it midway.
+    conn->get_refc ().increment ();
+    
+    s.conn = conn;
+    this->active.push_back (conn);
+  }
+  
+  void
+  replayer::close_session (session& s)
+  {
+    if (!s.conn)
+      return;
+    
+    connection *conn = s.conn;
+    s.sunk = conn->get_sunk_bytes ();
+    s.done = true;
+    s.conn = nullptr;
+    this->active.erase (
+      std::remove (this->active.begin (), this->active.end (), conn),
+      this->active.end ());
+    
+    conn->disconnect ();
+    conn->get_refc ().decrement ();
+  }
+  
+  void
+  replayer::feed (session& s, const capture_reader::record& rec)
+  {
+    connection *conn = s.conn;
+    if (conn->is_disconnected ())
+      return;
+    
+    // classify the packet by the state it was sent in and its opcode.
+    int hdr_len;
+    bin::read_varint (rec.data.data (), &hdr_len);
+    int opc = (hdr_len < (int)rec.data.size ())
+      ? bin::read_varint (rec.data.data () + hdr_len, nullptr) : -1;
+    bool play = conn->get_player () != nullptr;
+    
+    // the replay server never asks for encryption, so the client's answer
+    // to the original server's request has nowhere to go.
+    if (!play && opc == 0x01 && (s.flags & CAPTURE_F_ENCRYPTED)
+      && conn->get_protocol ()->get_name () != "<infer>")
+      {
+        ++ this->skipped;
+        return;
+      }
+    
+    packet_reader reader (rec.data.data (), (unsigned int)rec.data.size ());
+    auto start = replay_clock::now ();
+    conn->get_protocol ()->get_handler ()->handle (reader);
+    double secs = std::chrono::duration<double> (replay_clock::now () - start).count ();
+    
+    char key[32];
+    std::snprintf (key, sizeof key, "%s 0x%02X", play ? "play " : "login", opc);
+    opcode_stats& st = this->stats[key];
+    ++ st.count;
+    st.bytes += (long long)rec.data.size ();
+    st.secs += secs;
+    
+    ++ this->packets;
+    this->handler_secs += secs;
+  }
+  
+  void
+  replayer::tick ()
+  {
+    for (connection *conn : this->active)
+      conn->tick ();
+  }
+  
+  
+  
+  void
+  replayer::report (double wall_secs)
+  {
+    long long sunk = 0;
+    for (auto& s : this->sessions)
+      sunk += s.sunk;
+    
+    std::cout << std::fixed << std::setprecision (2)
+              << "replayed " << this->packets << " packets from "
+              << this->sessions.size () << " session(s) in " << wall_secs << " s";
+    if (this->skipped > 0)
+      std::cout << " (" << this->skipped << " skipped)";
+    std::cout << std::endl;
+    
+    std::cout << "  handlers:   " << std::setprecision (3)
+              << (this->handler_secs * 1000.0) << " ms total, "
+              << std::setprecision (0)
+              << (this->handler_secs > 0.0 ? this->packets / this->handler_secs : 0.0)
+              << " packets/s" << std::endl;
+    std::cout << "  sent:       " << sunk << " bytes" << std::endl;
+    std::cout << std::endl;
+    
+    std::cout << "  " << std::left << std::setw (12) << "packet" << std::right
+              << std::setw (10) << "count" << std::setw (12) << "bytes"
+              << std::setw (12) << "total ms" << std::setw (12) << "avg us"
+              << std::endl;
+    for (auto& p : this->stats)
+      {
+        const opcode_stats& st = p.second;
+        std::cout << "  " << std::left << std::setw (12) << p.first << std::right
+                  << std::setw (10) << st.count << std::setw (12) << st.bytes
+                  << std::setprecision (3) << std::setw (12) << (st.secs * 1000.0)
+                  << std::setprecision (2) << std::setw (12)
+                  << (st.secs * 1e6 / st.count) << std::endl;
+      }
+  }
+
+
+
+//------------------------------------------------------------------------------
+  
+  void
+  _print_usage (const char *prog)
+  {
+    replay_options d;
+    std::cout << "usage: " << prog << " [options] <capture files...>\n"
+      << "  -s, --speed FACTOR      replay speed relative to the recording (default: " << d.speed << ")\n"
+      << "  -f, --fast              replay as fast as possible\n"
+      << "  -l, --linger MS         keep sessions open after their last packet (default: " << d.linger << ")\n";
+  }
+  
+  bool
+  _parse_options (int argc, char *argv[], replay_options& opts)
+  {
+    static const struct option long_opts[] = {
+      { "speed",  required_argument, nullptr, 's' },
+      { "fast",   no_argument,       nullptr, 'f' },
+      { "linger", required_argument, nullptr, 'l' },
+      { "help",   no_argument,       nullptr, 'h' },
+      { nullptr, 0, nullptr, 0 },
+    };
+    
+    int c;
+    while ((c = getopt_long (argc, argv, "s:fl:h", long_opts, nullptr)) != -1)
+      {
+        switch (c)
+          {
+          case 's': opts.speed = std::atof (optarg); break;
+          case 'f': opts.fast = true; break;
+          case 'l': opts.linger = std::atoi (optarg); break;
+          
+          default:
+            return false;
+          }
+      }
+    
+    for (int i = optind; i < argc; ++i)
+      opts.files.push_back (argv[i]);
+    return !opts.files.empty () && opts.speed > 0.0 && opts.linger >= 0;
+  }
+}
+
+
+
+int
+main (int argc, char *argv[])
+{
+  replay_options opts;
+  if (!_parse_options (argc, argv, opts))
+    {
+      _print_usage (argv[0]);
+      return 1;
+    }
+  
+  std::vector<session> sessions;
+  _load_sessions (opts, sessions);
+  if (sessions.empty ())
+    {
+      std::cerr << "packet-replay: nothing to replay" << std::endl;
+      return 1;
+    }
+  
+  std::vector<replay_event> events;
+  _build_timeline (opts, sessions, events);
+  
+  hc::main_thread_raii tr;
+  evthread_use_pthreads ();
+  
+  logger log;
+  
+  server srv { log };
+  try
+    {
+      srv.start_offline ();
+    }
+  catch (const server_start_error& ex)
+    {
+      std::cerr << "packet-replay: could not start server: " << ex.what () << std::endl;
+      return 1;
+    }
+  
+  replayer rp { srv, opts, sessions };
+  auto start = replay_clock::now ();
+  rp.run (events);
+  double wall = std::chrono::duration<double> (replay_clock::now () - start).count ();
+  
+  srv.stop ();
+  rp.report (wall);
+  return 0;
+}